@@ -4,17 +4,79 @@
  * to the user's liking, and writes them back to the current directory
  */
 
+#define _POSIX_C_SOURCE 200809L  // getopt() under -std=c11
+
 #include <stdio.h>
+#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <signal.h>
+#include <fcntl.h>
 #include "demo.h"
+#include "engine.h"
+#include "exif.h"
+#include "html.h"
+#include "launch.h"
+#include "lqip.h"
+#include "pool.h"
+#include "quota.h"
+#include "resample.h"
 
 #define STRING_LEN 50
 #define RPIPE 0  // the pipe we read from
 #define WPIPE 1  // the pipe we write to
+#define IMG_OVERHEAD (8L << 20)  // memory an image process takes besides its pixels
+#define USAGE "Usage: ./album [-e] [-s] [-l] [-z] [-t size] [-m size] [-T formats] [-M formats] [-k kb[,kb]] [-w widths] [-p page_size] [-j jobs] [img]+\n" \
+  "  -e  rotate jpgs by their EXIF Orientation tag instead of their pixels\n" \
+  "  -s  pack each page's thumbnails into one sprite sheet (not with -w)\n" \
+  "  -l  inline a tiny blurred placeholder for each thumbnail\n" \
+  "  -z  also write gzip and brotli copies of the html, for a static server\n" \
+  "  -t  thumbnail size: a percentage (10%%, the default), a box to fit within (320x240)\n" \
+  "      or a long edge (320); a box or long edge never scales up\n" \
+  "  -m  medium-sized image size, likewise (25%% by default)\n" \
+  "  -T  thumbnail formats, best first, e.g. avif:50,webp:75,jpg:85\n" \
+  "  -M  medium-sized image formats, likewise\n" \
+  "  -k  most kilobytes a thumbnail jpg, then a medium-sized one, may take, e.g. 20,250\n" \
+  "  -w  also write each photo at these widths, e.g. 1920,1280,640, for a responsive album\n" \
+  "  -p  split the album into pages of page_size photos, index.html first\n" \
+  "  -j  convert this many photos at once, instead of as many as the cpus and memory allow\n"
+
+/* The formats one output size is written in (-T, -M). A jpg (or png)
+ * is always written, in the format of the source; the others are
+ * made from it by magick.
+ */
+typedef struct formats {
+  jpeg_opts_t jpg;          // progressive once -T or -M is given, budget from -k
+  int n;                    // formats besides the jpg, best first
+  char* ext[SOURCES_MAX];   // "avif" or "webp"
+  int quality[SOURCES_MAX];
+} formats_t;
+
+/* Command-line options, set by validate() before any fork,
+ * so every image process inherits them
+ */
+static struct options {
+  int exif_rotate;  // -e
+  int page_size;    // -p, 0 for one index.html
+  int sprites;      // -s
+  int placeholders; // -l
+  int precompress;  // -z
+  formats_t thumb;  // -T
+  formats_t med;    // -M
+  char* thumb_size; // -t, see engine_percent()
+  char* med_size;   // -m
+  int widths[PYRAMID_MAX];  // -w, widest first
+  int nwidths;
+  long* costs;      // per img, its pixels times components, from its header alone
+  int jobs;         // -j, 0 to size it from the cpus and memory
+} opts;
+
+/* magick workers for the images the engine can't handle,
+ * started by process() before any fork, see pool.c
+ */
+static pool_t pool;
 
 /* Determines whether the first 8 bytes in arg param,
  * which encapsulate at least the file header bytes,
@@ -37,12 +99,102 @@ static int header_is_img(unsigned char bytes[8]) {
     (bytes[0] == gif[0] && bytes[1] == gif[1] && bytes[2] == gif[2]));
 }
 
-/* Checks if the file given is a valid path & a valid image file
+/* Reads an n-byte unsigned number, big-endian (jpg, png)
+ * or little-endian (gif, bmp)
+ *
+ * @return the number, -1 at the end of the file
+ */
+static long read_num(FILE* fp, int n, int big_endian) {
+  long num = 0;
+  int i, c;
+  for (i = 0; i < n; i++) {
+    if ((c = fgetc(fp)) == EOF)
+      return -1;
+    num = big_endian ? (num << 8) | c : num | ((long) c << (8 * i));
+  }
+  return num;
+}
+
+/* Reads the size of an image from its header, without decoding it:
+ * a jpg's SOF segment, a png's IHDR chunk, a gif's logical screen
+ * descriptor or a bmp's DIB header
+ * https://www.w3.org/Graphics/JPEG/itu-t81.pdf (B.2.2)
+ * https://www.w3.org/TR/png/#11IHDR
+ *
+ * @param fp the image, just past its first 8 bytes
+ * @param bytes its first 8 bytes
+ * @return the image's pixels times components, 0 if the header can't be read
+ */
+static long header_cost(FILE* fp, unsigned char bytes[8]) {
+  static int png_channels[] = {1, 0, 3, 3, 2, 0, 4};  // by color type
+  long width = -1, height = -1, comps = 3, marker, len, bpp;
+
+  if (bytes[0] == 0xff && bytes[1] == 0xd8) {
+    // walk the segments to the first SOFn (not DHT, JPG or DAC, which share the range)
+    fseek(fp, 2, SEEK_SET);
+    while ((marker = read_num(fp, 2, 1)) >= 0) {
+      while (marker == 0xffff)  // fill bytes
+	marker = 0xff00 | read_num(fp, 1, 1);
+      if ((marker & 0xff00) != 0xff00 || marker == 0xffd9 || marker == 0xffda)
+	break;
+      if (marker == 0xff01 || (marker >= 0xffd0 && marker <= 0xffd7))
+	continue;  // no length
+      if ((len = read_num(fp, 2, 1)) < 2)
+	break;
+      if (marker >= 0xffc0 && marker <= 0xffcf && marker != 0xffc4 && marker != 0xffc8 && marker != 0xffcc) {
+	read_num(fp, 1, 1);  // precision
+	height = read_num(fp, 2, 1);
+	width = read_num(fp, 2, 1);
+	comps = read_num(fp, 1, 1);
+	break;
+      }
+      fseek(fp, len - 2, SEEK_CUR);
+    }
+  }
+  else if (bytes[0] == 0x89) {
+    if (read_num(fp, 4, 1) >= 0 && read_num(fp, 4, 1) == 0x49484452) {  // "IHDR"
+      width = read_num(fp, 4, 1);
+      height = read_num(fp, 4, 1);
+      read_num(fp, 1, 1);  // bit depth
+      marker = read_num(fp, 1, 1);
+      comps = marker >= 0 && marker <= 6 ? png_channels[marker] : 0;
+    }
+  }
+  else if (bytes[0] == 'G') {
+    fseek(fp, 6, SEEK_SET);
+    width = read_num(fp, 2, 0);
+    height = read_num(fp, 2, 0);
+  }
+  else {
+    fseek(fp, 14, SEEK_SET);
+    if ((len = read_num(fp, 4, 0)) == 12) {  // BITMAPCOREHEADER
+      width = read_num(fp, 2, 0);
+      height = read_num(fp, 2, 0);
+    }
+    else if (len >= 40) {  // BITMAPINFOHEADER and later
+      width = read_num(fp, 4, 0);
+      height = read_num(fp, 4, 0);
+      if (height > 0x7fffffffL)
+	height = 0x100000000L - height;  // top-down
+    }
+    read_num(fp, 2, 0);  // planes
+    if ((bpp = read_num(fp, 2, 0)) >= 24)
+      comps = bpp / 8;
+  }
+
+  if (width <= 0 || height <= 0 || comps <= 0)
+    return 0;
+  return width * height * comps;
+}
+
+/* Checks if the file given is a valid path & a valid image file,
+ * and reads how big it is from its header
  *
  * @param path the file path 
+ * @param cost set to the image's pixels times components, 0 if unknown
  * @return -1 if invalid, 0 if valid
  */
-static int invalid_img(char* path) {
+static int invalid_img(char* path, long* cost) {
   FILE* fp;
   unsigned char bytes[8];
 
@@ -51,34 +203,209 @@ static int invalid_img(char* path) {
     return -1;
 
   // check valid image file
-  fread(bytes, 8, 1, fp);    // read first 8 bytes of file, which identify if it is img
-  if (!header_is_img(bytes)) // if bytes dont match img headers, -1
+  // read first 8 bytes of file, which identify if it is img
+  if (fread(bytes, 8, 1, fp) != 1 || !header_is_img(bytes)) { // if bytes dont match img headers, -1
+    fclose(fp);
     return -1;
+  }
+  *cost = header_cost(fp, bytes);
    
   fclose(fp);
   return 0;
 }
 
+/* Parses a list of formats, e.g. "avif:50,webp:75,jpg:85",
+ * each a name and an optional quality from 1 to 100
+ *
+ * @param list the list, from the command line
+ * @param f the formats to fill
+ * @return -1 if list is not a valid list, 0 on success
+ */
+static int parse_formats(char* list, formats_t* f) {
+  static char* names[] = {"avif", "webp"};
+  static int qualities[] = {50, 75};  // about as good as a jpg at JPEG_QUALITY
+  char* name;
+  int i;
+
+  f->jpg.quality = 0;  // the photo's own, unless given
+  f->jpg.progressive = 1;
+  f->n = 0;
+  for (name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+    char* colon = strchr(name, ':');
+    int quality = -1;
+    if (colon != NULL) {
+      *colon = '\0';
+      if ((quality = atoi(colon + 1)) < 1 || quality > 100)
+	return -1;
+    }
+    if (strcmp(name, "jpg") == 0 || strcmp(name, "jpeg") == 0) {
+      if (quality > 0)
+	f->jpg.quality = quality;
+      continue;
+    }
+    for (i = 0; i < 2 && strcmp(name, names[i]) != 0; i++)
+      ;
+    if (i == 2 || f->n == SOURCES_MAX)
+      return -1;
+    f->ext[f->n] = names[i];
+    f->quality[f->n++] = quality > 0 ? quality : qualities[i];
+  }
+  return 0;
+}
+
+/* Parses the byte budgets of -k, e.g. "20,250": kilobytes for
+ * each thumbnail, then optionally for each medium-sized image
+ *
+ * @param list the list, from the command line
+ * @return -1 if list is not a valid list, 0 on success
+ */
+static int parse_budgets(char* list) {
+  long* budgets[] = {&opts.thumb.jpg.budget, &opts.med.jpg.budget};
+  char* kb;
+  int i = 0;
+
+  for (kb = strtok(list, ","); kb != NULL; kb = strtok(NULL, ",")) {
+    if (i == 2 || atol(kb) <= 0)
+      return -1;
+    *budgets[i++] = atol(kb) * 1024;
+  }
+  return i > 0 ? 0 : -1;
+}
+
+/* Parses a list of widths, e.g. "640,1920,1280", into
+ * opts.widths, widest first, without repeats
+ *
+ * @param list the list, from the command line
+ * @return -1 if list is not a valid list, 0 on success
+ */
+static int parse_widths(char* list) {
+  char* width;
+  int i, w;
+
+  opts.nwidths = 0;
+  for (width = strtok(list, ","); width != NULL; width = strtok(NULL, ",")) {
+    if ((w = atoi(width)) <= 0)
+      return -1;
+    for (i = 0; i < opts.nwidths && opts.widths[i] > w; i++)
+      ;
+    if (i < opts.nwidths && opts.widths[i] == w)
+      continue;
+    if (opts.nwidths == PYRAMID_MAX)
+      return -1;
+    memmove(opts.widths + i + 1, opts.widths + i, (opts.nwidths - i) * sizeof(int));
+    opts.widths[i] = w;
+    opts.nwidths++;
+  }
+  return 0;
+}
+
 /* Validates command-line args from main().
- * Checks if there is at least 1 img argument,
- * and if the files are valid image paths
+ * Parses the options into opts, then checks if there
+ * is at least 1 img argument, and if the files are valid image paths.
+ * On success, optind is the index of the first img in argv
  * 
  * @param argc the arg count
  * @param argv the args
  * @return -1 if invalid params, 0 if valid
  */
 static int validate(int argc, char* argv[]) {
-  int i; 
+  int i, opt;
+
+  opts.thumb_size = "10%";
+  opts.med_size = "25%";
+  opts.thumb.jpg.quality = 0;  // the photo's own
+  opts.med.jpg.quality = 0;
+  opts.thumb.jpg.exif = EXIF_ORIENTATION;  // the widths' too
+  opts.med.jpg.exif = EXIF_CAMERA;
+  while ((opt = getopt(argc, argv, "eslzt:m:T:M:k:w:p:j:")) != -1) {
+    switch (opt) {
+    case 'e':
+      opts.exif_rotate = 1;
+      break;
+    case 's':
+      opts.sprites = 1;
+      break;
+    case 'l':
+      opts.placeholders = 1;
+      break;
+    case 'z':
+      opts.precompress = 1;
+      break;
+    case 't':
+    case 'm':
+      // any image will do to check the size
+      if (engine_percent(optarg, 1000, 1000) < 0) {
+	fprintf(stderr, "Error: size must be a percentage (10%%), a box (320x240) or a long edge (320): %s\n", optarg);
+	return -1;
+      }
+      if (opt == 't')
+	opts.thumb_size = optarg;
+      else
+	opts.med_size = optarg;
+      break;
+    case 'T':
+    case 'M':
+      if (parse_formats(optarg, opt == 'T' ? &opts.thumb : &opts.med)) {
+	fprintf(stderr, "Error: formats must be a list of avif, webp or jpg, each with an optional quality: %s\n", optarg);
+	return -1;
+      }
+      break;
+    case 'k':
+      if (parse_budgets(optarg)) {
+	fprintf(stderr, "Error: budgets must be one or two positive numbers of kilobytes: %s\n", optarg);
+	return -1;
+      }
+      break;
+    case 'w':
+      if (parse_widths(optarg)) {
+	fprintf(stderr, "Error: widths must be a list of at most %d positive numbers: %s\n", PYRAMID_MAX, optarg);
+	return -1;
+      }
+      break;
+    case 'p':
+      if ((opts.page_size = atoi(optarg)) <= 0) {
+	fprintf(stderr, "Error: page size must be a positive number: %s\n", optarg);
+	return -1;
+      }
+      break;
+    case 'j':
+      if ((opts.jobs = atoi(optarg)) <= 0) {
+	fprintf(stderr, "Error: jobs must be a positive number: %s\n", optarg);
+	return -1;
+      }
+      break;
+    default:
+      fprintf(stderr, USAGE);
+      return -1;
+    }
+  }
+
+  // once either -T or -M is given, every jpg is progressive
+  if (opts.thumb.jpg.progressive || opts.med.jpg.progressive)
+    opts.thumb.jpg.progressive = opts.med.jpg.progressive = 1;
+
+  // a sprite has one size, and a photo with widths has several
+  if (opts.sprites && opts.nwidths > 0) {
+    fprintf(stderr, "Error: -s and -w can't be used together\n");
+    fprintf(stderr, USAGE);
+    return -1;
+  }
 
   // not enough args(2)
-  if (argc <= 1) {  
-    fprintf(stderr, "Usage: ./album [img]+\n");
+  if (optind >= argc) {  
+    fprintf(stderr, USAGE);
     return -1;
   }
 
+  // more slots than imgs would sit empty
+  if (opts.jobs > argc - optind)
+    opts.jobs = argc - optind;
+
   // not valid path and image
-  for (i = 1; i < argc; i++) {
-    if (invalid_img(argv[i])) {
+  if ((opts.costs = (long*) calloc(argc - optind, sizeof(long))) == NULL)
+    return -1;
+  for (i = optind; i < argc; i++) {
+    if (invalid_img(argv[i], &opts.costs[i - optind])) {
       fprintf(stderr, "Error: one (or more) img is not a valid image or path: %s\n", argv[i]);
       return -1;
     }
@@ -87,12 +414,29 @@ static int validate(int argc, char* argv[]) {
   return 0;
 }
 
+/* Converts a size (see engine_percent()) to magick's geometry for
+ * it: a percentage as it is, a box or a long edge only ever shrunk
+ *
+ * @param size the size
+ * @param geometry filled with the geometry
+ * @param len the size of geometry
+ */
+static void magick_geometry(const char* size, char* geometry, int len) {
+  if (size[strlen(size) - 1] == '%')
+    snprintf(geometry, len, "%s", size);
+  else if (strchr(size, 'x') != NULL)
+    snprintf(geometry, len, "%s>", size);
+  else
+    snprintf(geometry, len, "%sx%s>", size, size);
+}
+
 /* Forks a new process, resizes an image and renames it. 
- * - The child process will call exec() to launch a new program, magick resize,
- * and should exit the program via magick.
+ * - The child process resizes in-process with the engine (jpg, png). If the
+ * engine can't handle the image, it will call exec() to launch a new program,
+ * magick resize, and should exit the program via magick.
  * - The parent process returns the child's pid after fork
  *
- * size is in units of %, and the char* must contain a number folloed by "%"
+ * size is a percentage, a box or a long edge, see engine_percent()
  *
  * Assumptions: img is a valid image file path, size is valid input 
  * for magick command. Since function is internal, I can ensure 
@@ -109,7 +453,19 @@ static int resize(char* img, char* rename, char* size) {
 #ifdef VERBOSE
     printf("resizing %s now by %s...\n", img, size);
 #endif
-    execlp("magick", "magick", "convert", "-resize", size, img, rename, NULL);
+    if (engine_resize(img, rename, size) == 0)
+      exit(0);
+
+#ifdef VERBOSE
+    printf("engine can't resize %s, falling back on magick...\n", img);
+#endif
+    char geometry[64];
+    magick_geometry(size, geometry, sizeof(geometry));
+    char* ops[] = {"-read", img, "-resize", geometry, NULL};
+    if (pool_run(&pool, ops, rename) == 0)
+      exit(0);
+    char* argv[] = {"magick", "convert", "-resize", geometry, img, rename, NULL};
+    launch_exec(argv);
 
     // if exec errors
     fprintf(stderr, "Failed to exec() on magick's resize command\n");
@@ -119,35 +475,142 @@ static int resize(char* img, char* rename, char* size) {
   return pid;
 }
 
-/* Forks a new process and displays an image. 
- * - The child process will call exec()to launch a new program, magick display,
- * and should exit the program via magick.
+/* Forks a new process that writes an image in another format,
+ * one the engine can't write (avif, webp), with magick. It is made
+ * from the source image, resized and turned like the engine's output,
+ * rather than from that output, so it is only compressed lossily once.
+ * - The child process sends the job to the magick workers, or
+ * calls exec() to launch magick convert if there are none.
+ * The rotation is always done to the pixels, even with -e,
+ * since the new format may not carry the tag.
  * - The parent process returns the child's pid after fork
  *
- * Assumptions: same as resize() assumption; see above.
- *
- * @param img the image to display
+ * @param img the source image
+ * @param dest the file to write, whose extension names the format
+ * @param geometry the size, as magick's geometry
+ * @param rot_dir 1 for clockwise, 2 for counter-clockwise, 0 for none
+ * @param quality the quality, 1 to 100
  * @return the pid of the child process
  */
-static int display(char* img) {
+static int transcode(char* img, char* dest, char* geometry, int rot_dir, int quality) {
   int pid;
-  if ((pid = fork()) == 0) {  
+  if ((pid = fork()) == 0) {
+    char q[8];
+    char* direction = rot_dir == 1 ? "90" : rot_dir == 2 ? "-90" : "0";
+    sprintf(q, "%d", quality);
 #ifdef VERBOSE
-    printf("displaying %s now...\n", img);
+    printf("writing %s from %s at quality %s...\n", dest, img, q);
 #endif
-    execlp("magick", "magick", "display", img, NULL);
-    
+    char* ops[] = {"-read", img, "-resize", geometry, "-rotate", direction, "-quality", q, NULL};
+    if (pool_run(&pool, ops, dest) == 0)
+      exit(0);
+    char* argv[] = {"magick", "convert", img, "-resize", geometry, "-rotate", direction, "-quality", q, dest, NULL};
+    launch_exec(argv);
+
     // if exec errors
-    fprintf(stderr, "Failed to exec() on magick's display command\n");
+    fprintf(stderr, "Failed to exec() on magick's convert command\n");
     exit(-1);
   }
 
   return pid;
 }
 
+/* Starts writing an output of an image in each of the other formats
+ * asked for, named after the output with the format's extension
+ *
+ * @param img the source image
+ * @param out the output, as the engine names it, e.g. "thumb_photo.jpg"
+ * @param geometry its size, as magick's geometry
+ * @param rot_dir the rotation, see transcode()
+ * @param f the formats
+ * @param names filled with the files being written, NULL if not started, freed by the caller
+ * @param pids filled with the pids of the transcode() children, -1 if not started
+ */
+static void transcode_all(char* img, char* out, char* geometry, int rot_dir, const formats_t* f, char* names[], int pids[]) {
+  char* dot = strrchr(out, '.');
+  int i, len = dot != NULL ? (int) (dot - out) : (int) strlen(out);
+
+  for (i = 0; i < f->n; i++) {
+    pids[i] = -1;
+    if ((names[i] = (char*) malloc(len + strlen(f->ext[i]) + 2)) == NULL)
+      continue;
+    sprintf(names[i], "%.*s.%s", len, out, f->ext[i]);
+    pids[i] = transcode(img, names[i], geometry, rot_dir, f->quality[i]);
+  }
+}
+
+/* Waits for a transcode() child
+ *
+ * @param pid the child's pid, set to -1 once it is reaped
+ * @return 1 if it wrote its file, 0 if not
+ */
+static int transcoded(int* pid) {
+  int status, ret;
+  if (*pid <= 0)
+    return 0;
+  ret = waitpid(*pid, &status, 0) > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  *pid = -1;
+  return ret;
+}
+
+/* Adds a file to a srcset
+ *
+ * @param srcset the srcset, SRCSET_LEN long
+ * @param name the file
+ * @param width how wide it is, 0 to leave the width out (a srcset of one)
+ */
+static void add_candidate(char* srcset, char* name, int width) {
+  size_t len = strlen(srcset);
+  char candidate[SRCSET_LEN];
+
+  if (width > 0)
+    snprintf(candidate, sizeof(candidate), "%s%s %dw", len > 0 ? ", " : "", name, width);
+  else
+    snprintf(candidate, sizeof(candidate), "%s%s", len > 0 ? ", " : "", name);
+  if (len + strlen(candidate) < SRCSET_LEN)
+    strcat(srcset, candidate);
+}
+
+/* Spawns a new process, magick display, that displays an image.
+ * There is nothing to do in a forked child first, so it is
+ * posix_spawn()ed straight away rather than fork()ed and exec()ed.
+ *
+ * Assumptions: same as resize() assumption; see above.
+ *
+ * @param img the image to display
+ * @return the pid of the child process, -1 if it could not be started
+ */
+static int display(char* img) {
+  char* argv[] = {"magick", "display", img, NULL};
+  int pid;
+#ifdef VERBOSE
+  printf("displaying %s now...\n", img);
+#endif
+  if ((pid = launch_magick(argv, -1, -1)) < 0)
+    fprintf(stderr, "Failed to spawn magick's display command\n");
+  return pid;
+}
+
+/* Maps a rotation direction to the EXIF Orientation value
+ * that makes a viewer display the image turned that way
+ *
+ * @param rot_dir 1 for clockwise, 2 for counter-clockwise
+ * @return the Orientation value
+ */
+static int exif_orientation(int rot_dir) {
+  if (rot_dir == 1)
+    return ORIENT_CW;
+  if (rot_dir == 2)
+    return ORIENT_CCW;
+  return ORIENT_NORMAL;
+}
+
 /* Forks a new process, rotates the image and renames it. 
- * - The child process will call exec() to launch a new program, magick rotate,
- * and should exit the program via magick.
+ * - With -e, the child process only sets the EXIF Orientation tag of a jpg
+ * being rotated in place, leaving its pixels alone.
+ * - The child process rotates a jpg losslessly in-process with the engine.
+ * For other formats, or a jpg whose edge isn't MCU-aligned, it will call exec()
+ * to launch a new program, magick rotate, and should exit the program via magick.
  * - The parent process returns the child's pid after fork
  *
  * If rot_dir = 1, 90 degrees clockwise
@@ -167,6 +630,10 @@ static int rotate(char* img, char* rename, int rot_dir) {
 #ifdef VERBOSE
     printf("rotating %s now in dir: %d\n", img, rot_dir);
 #endif
+    if (opts.exif_rotate && strcmp(img, rename) == 0 && exif_set_orientation(img, exif_orientation(rot_dir)) == 0)
+      exit(0);
+    if (engine_rotate(img, rename, rot_dir) == 0)
+      exit(0);
   
     char* direction;
   
@@ -176,8 +643,12 @@ static int rotate(char* img, char* rename, int rot_dir) {
       direction = "-90";
     else
       direction = "0";  // failsafe if rot_dir is weird input
-    
-    execlp("magick", "magick", "convert", "-rotate", direction, img, rename, NULL);
+
+    char* ops[] = {"-read", img, "-rotate", direction, NULL};
+    if (pool_run(&pool, ops, rename) == 0)
+      exit(0);
+    char* argv[] = {"magick", "convert", "-rotate", direction, img, rename, NULL};
+    launch_exec(argv);
   
     // if exec errors
     fprintf(stderr, "Failed to exec() on magick's rotate command.\n");
@@ -187,6 +658,166 @@ static int rotate(char* img, char* rename, int rot_dir) {
   return pid;
 }
 
+/* The file name of a photo at one of the widths (-w): "w640_photoname"
+ *
+ * @param thumb_name the photo's thumbnail, "thumb_photoname"
+ * @param width the width
+ * @return the name, freed by the caller, NULL if out of memory
+ */
+static char* level_name(char* thumb_name, int width) {
+  char* name = (char*) malloc(strlen(thumb_name) + 16);
+  if (name != NULL)
+    sprintf(name, "w%d_%s", width, thumb_name + strlen("thumb_"));
+  return name;
+}
+
+/* Writes the widths (-w) of a photo, and removes any file left from
+ * an earlier album at a width that wasn't made this time
+ *
+ * @param p the widths, see engine_pyramid()
+ * @param thumb_name the photo's thumbnail
+ * @param orientation the EXIF Orientation to tag each with, 0 for the source's
+ * @return -1 on error, 0 on success
+ */
+static int write_levels(const pyramid_t* p, char* thumb_name, int orientation) {
+  jpeg_opts_t jpg = opts.thumb.jpg;
+  int i, ret = 0;
+
+  jpg.budget = 0;  // -k is for thumbnails, not photos as wide as the screen
+  jpg.orientation = orientation;
+  for (i = 0; i < opts.nwidths; i++) {
+    char* name = level_name(thumb_name, opts.widths[i]);
+    if (name == NULL)
+      return -1;
+    if (!engine_pyramid_has(p, i))
+      remove(name);
+    else if (engine_pyramid_encode(p, i, name, &jpg))
+      ret = -1;
+    free(name);
+  }
+  return ret;
+}
+
+/* Tells the image process the thumbnail is on disk. When it shows
+ * the photo's EXIF preview instead, it doesn't wait on the thumbnail
+ * and has closed its end, which is no error.
+ *
+ * @param to_parent the write end of the pipe
+ */
+static void thumb_ready(int to_parent) {
+  void (*handler)(int) = signal(SIGPIPE, SIG_IGN);
+  int send = 0;
+
+  if (write(to_parent, &send, sizeof(int)) < 0 && errno != EPIPE)
+    fprintf(stderr, "error writing bytes to parent\n");
+  signal(SIGPIPE, handler);
+}
+
+/* Forks a new process that produces both the thumbnail and the
+ * medium-sized image from a single decode of img, and that applies
+ * the user's rotation to them. Creates a pipe from child to parent to say
+ * when the thumbnail is ready to display, and one from parent to child
+ * to pass on the rotation the user asked for (0 if none).
+ * - The child process decodes img once with the engine, resamples the
+ * medium from it, then the thumbnail from the medium. It writes the thumbnail,
+ * tells the parent, and holds the medium in memory until the rotation
+ * arrives, so the medium is rotated and encoded only once.
+ * With widths (-w), it builds the photo at each of them while the user
+ * looks at the thumbnail, and writes them along with the medium.
+ * If the engine can't handle img, the child falls back on two resize()
+ * children, then rotate() children once the rotation arrives.
+ * - The parent process returns the child's pid after fork
+ *
+ * Assumptions: same as resize() assumption; see above.
+ *
+ * @param img the image to resize
+ * @param thumb_name the filename for the thumbnail
+ * @param med_name the filename for the medium-sized image
+ * @param ready the pipe from child to parent, thumbnail is ready
+ * @param orient the pipe from parent to child, the rotation
+ * @return the pid of the child process, -1 on error creating pipes
+ */
+static int fanout(char* img, char* thumb_name, char* med_name, int ready[2], int orient[2]) {
+  int pid;
+
+  // create pipe and validate its creation
+  if (pipe(ready) != 0 || pipe(orient) != 0) {
+    fprintf(stderr, "failed to create a pipe\n");
+    return -1;
+  }
+
+  if ((pid = fork()) == 0) {
+    fanout_t f;
+    int rot_dir = 0, ret;
+    int to_parent = ready[WPIPE], from_parent = orient[RPIPE];
+
+    close(ready[RPIPE]);
+    close(orient[WPIPE]);
+#ifdef VERBOSE
+    printf("resizing %s now to %s and %s with %s kernels...\n", img, opts.med_size, opts.thumb_size, resample_isa());
+#endif
+    if (engine_fanout(img, opts.thumb_size, opts.med_size, opts.widths, opts.nwidths, &f) == 0) {
+      pyramid_t levels = {.format = FMT_UNKNOWN};
+      jpeg_opts_t thumb_jpg = opts.thumb.jpg, med_jpg = opts.med.jpg;
+      ret = engine_fanout_encode(&f, 0, thumb_name, &thumb_jpg);
+
+      // thumbnail is on disk, it can be displayed
+      thumb_ready(to_parent);
+      if (opts.nwidths > 0 && engine_pyramid(&f, &levels) != 0)
+	fprintf(stderr, "Error making %s at the widths asked for\n", img);
+      if (read(from_parent, &rot_dir, sizeof(int)) <= 0)
+	rot_dir = 0; // parent is gone, keep the orientation
+
+      if (rot_dir > 0 && opts.exif_rotate && f.format == FMT_JPEG) {
+	// leave the pixels alone, tag every file instead; the tag is written
+	// with the pixels, so a budget (-k) is fitted with it in
+	thumb_jpg.orientation = med_jpg.orientation = exif_orientation(rot_dir);
+	ret = engine_fanout_encode(&f, 0, thumb_name, &thumb_jpg);
+      }
+      else if (rot_dir > 0) {
+	if (engine_fanout_rotate(&f, rot_dir) || engine_pyramid_rotate(&levels, rot_dir))
+	  ret = -1;
+	else
+	  ret = engine_fanout_encode(&f, 0, thumb_name, &thumb_jpg);
+      }
+      if (engine_fanout_encode(&f, 1, med_name, &med_jpg) || write_levels(&levels, thumb_name, med_jpg.orientation))
+	ret = -1;
+
+      engine_fanout_free(&f);
+      engine_pyramid_free(&levels);
+      exit(ret ? -1 : 0);
+    }
+
+    // only the engine makes the widths
+    pyramid_t none = {.format = FMT_UNKNOWN};
+    write_levels(&none, thumb_name, 0);
+
+    int res_thumb, res_med, status_thumb, status_med;
+    res_thumb = resize(img, thumb_name, opts.thumb_size);
+    res_med = resize(img, med_name, opts.med_size);
+    waitpid(res_thumb, &status_thumb, 0);
+
+    thumb_ready(to_parent);
+    if (read(from_parent, &rot_dir, sizeof(int)) <= 0)
+      rot_dir = 0;
+
+    // make sure the new filename for medium is there
+    // so that magick can open it
+    waitpid(res_med, &status_med, 0);
+    if (rot_dir > 0) {
+      res_thumb = rotate(thumb_name, thumb_name, rot_dir);
+      res_med = rotate(med_name, med_name, rot_dir);
+      waitpid(res_thumb, &status_thumb, 0);
+      waitpid(res_med, &status_med, 0);
+    }
+    exit(status_thumb || status_med ? -1 : 0);
+  }
+
+  close(ready[WPIPE]);
+  close(orient[RPIPE]);
+  return pid;
+}
+
 /* Creates a pipe between parent and child to communicate
  * about asking the user if they want to rotate the image
  * and desired caption. Utilizes fork() to create separate 
@@ -333,71 +964,12 @@ static int ask_caption(int sv1[2], int sv2[2], char* caption) {
   return 0;
 }
 
-/* Creates or edits an "index.html" file, writing
- * the thumbnail linked by a medium-sized image.
- * cap_html() will later finish the writing for individual 
- * image by writing the caption.
- *
- * Note: index = 0 signifies the first image to add to html.
- * In that case, if "index.html" already exists, 
- * overwrite it with "w" - write, instead of "a" - append
- *
- * @param thumb_name the thumbnail
- * @param med_name, the medium-sized image
- * @param index the index of photo to write to html
- * @return -1 on error, 0 on successful write
- */
-
-static int img_html(char* thumb_name, char* med_name, int order) {
-#ifdef VERBOSE
-  printf("writing img to html now for %s...\n", thumb_name);
-#endif
-  
-  FILE* fp;
-  char* w_or_a = "a";
-
-  // overwrite "index.html" if first photo to edit
-  if (order == 1)
-    w_or_a = "w";
-  
-  if ((fp = fopen("index.html", w_or_a)) == NULL) {
-    fprintf(stderr, "Error writing to index.html\n");
-    return -1;
-  }
-  fprintf(fp, "<a href=\"%s\"><img src=\"%s\"></a>", med_name, thumb_name);
-  
-  fclose(fp);
-  return 0;
-}
-
-/* Write the caption of image to "index.html"
- *
- * @param caption the caption
- * @return -1 on error, 0 on successful write
- */
-static int cap_html(char* caption) {
-#ifdef VERBOSE
-  printf("adding caption %s to html now...\n", caption);
-#endif
-  
-  FILE* fp;
-  
-  if ((fp = fopen("index.html", "a")) == NULL) {
-    fprintf(stderr, "Error writing to index.html\n");
-    return -1;
-  }
-  fprintf(fp, "<h2>%s</h2>", caption);
-  
-  fclose(fp);
-  return 0;
-}
-
 /* Executes the image editing process for one image, including:
- *   1. resizing 10% for thumbnail and adding to directory
- *   2. displaying thumbnail
+ *   1. resizing 25% for medium and 10% for thumbnail (from one decode), adding thumbnail to directory
+ *   2. displaying thumbnail (or the embedded exif preview, while the thumbnail is still resizing)
  *   3. asking the user whether to rotate (and rotating if so)
  *   4. asking the user for a caption
- *   5. resizing 25% and rotating (if desired) for medium-sized image and adding to directory
+ *   5. rotating (if desired) the held medium-sized image once and adding to directory
  *   6. adding the thumbnail, caption, and link from thumbnail -> medium to "index.html"
  *
  * Assumptions: assumes params have been validated for correctness
@@ -405,93 +977,71 @@ static int cap_html(char* caption) {
  * @param img the image to process
  * @param thumb_name the desired thumbnail name
  * @param med_name the desired medium-sized image name
+ * @param preview_name the name to extract the embedded exif preview to, if any
  * @param index the index of the image
- * @param ptp the pipe for communicating about displaying the next image
- * @param html_order the pipe for communicating about which write_html process to write next to html
+ * @param from_prev read end of the pipe from the previous image, which says when it may display
+ * @param to_next write end of the pipe to the next image, to say when it may display,
+ *        -1 for the last image
+ * @param html_out the write end of the html writer's pipe, see html.c
  * @return 0 on successful processing, -1 otherwise
  */
-static int process_img(char* img, char* thumb_name, char* med_name, int index, int ptp1[2], int ptp2[2]) {
-  int res_thumb, res_med, dis_thumb, rot_dir, status;
+static int process_img(char* img, char* thumb_name, char* med_name, char* preview_name, int index, int from_prev, int to_next, int html_out) {
+  int res_both, dis_thumb, rot_dir, status;
+  char* display_name;
   int sv1[2], sv2[2]; // sv1 = parent -> child; sv2 = child -> parent
+  int ready[2], orient[2]; // ready = fanout -> parent; orient = parent -> fanout
   int send = 0, receive;
-  int to_next = ptp1[WPIPE];    // ptp1 is from img_process to next img_process
-  int from_prev = ptp1[RPIPE];
-  int html_out = ptp2[WPIPE];  // ptp2 is from any img_process to the
-  int html_in = ptp2[RPIPE];   // next img_process that comes through the processor
+  int launches[2], launched;  // counts the programs started for this img, see launch.c
   char caption[STRING_LEN];
+  char placeholder[LQIP_LEN];
+  char* shown[PYRAMID_MAX + 1];  // the thumbnail, then the photo at each width made (-w)
+  int widths[PYRAMID_MAX + 1];   // how wide each displays
+  int levels[PYRAMID_MAX + 1];   // which of alts each is: 0 the thumbnail, 1 + i opts.widths[i]
+  char* alts[PYRAMID_MAX + 1][SOURCES_MAX], *meds[SOURCES_MAX];  // in the other formats (-T, -M)
+  int alt_pids[PYRAMID_MAX + 1][SOURCES_MAX], med_pids[SOURCES_MAX];
+  char geometry[64];
+  int src_width, src_height;
+  char srcsets[SOURCES_MAX + 1][SRCSET_LEN];  // the <img>'s, then each <source>'s
+  int i, j, n = 0, nshown = 0;
+  entry_t entry = {0};
   
   index++; // change index to cardinal starting at 1 instead of 0 for readability
+  if (launch_count_start(launches))
+    exit(-1);
 
 //////////////////////////// RESIZING //////////////////////////////////
 
-  /*********** Fork for resizing thumbnail ***********/
+  /*********** Fork for resizing medium and thumbnail ***********/
 #ifdef VERBOSE
-  printf("------%d forking for thumb resize\n", index);
-#endif
-  res_thumb = resize(img, thumb_name, "10%");
-  
-  /*********** Fork for medium resize **********/        
-#ifdef VERBOSE                                           
-  printf("------%d forking for med resize\n", index);              
+  printf("------%d forking for med and thumb resize\n", index);
 #endif
-  res_med = resize(img, med_name, "25%");              
+  if ((res_both = fanout(img, thumb_name, med_name, ready, orient)) < 0)
+    exit(-1);
 
-//////////////////////// WAIT FOR PREV IMG TO FINISH TO CONTINUE /////////////////////
+//////////////////////////// DISPLAYING ///////////////////////////////
 
-// can't display next and write html for next until caption
-// is asked and caption is written to html, respectively
-// SPECIAL CASE: First image  
-  if (index != 1) {
-    // want to wait until previous html image is set
-    // aka after caption from prev image is written to html
-    int cont = 1;                           
-    while (cont) {
-      // read signal for whose turn it is to write html
-      if (read(html_in, &receive, sizeof(int)) < 0) {
-	fprintf(stderr, "error reading bytes from other img process. exiting...\n");
-	exit(-1);
-      }
-#if defined (VERBOSE) || (WAIT)
-      printf("%d received %d\n", index, receive);
-#endif
-      // send the same write signal right back out if
-      // receive signal != your index
-      // aka NOT your turn to write html
-      if (index != receive) {
-	if (write(html_out, &receive, sizeof(int)) < 0) {
-	  fprintf(stderr, "error writing bytes out other img process. exiting...\n");
-	  exit(-1);
-	}
-#if defined (VERBOSE) || (WAIT)
-	printf("%d resending %d\n", index, receive);
+  // Cameras embed a small preview in the EXIF segment. If there is one,
+  // display it right away instead of waiting on the thumbnail resize
+  if (exif_thumbnail(img, preview_name) == 0) {
+#ifdef VERBOSE
+    printf("---%d using embedded exif preview, not waiting for thumb resize\n", index);
 #endif
-	sleep(1); // move out of the way
-      }
-      else  // continue out of while loop if it is your turn to write
-	cont = 0;
-    }
+    display_name = preview_name;
+    close(ready[RPIPE]);  // nothing to wait for, and the display and asking children would inherit it
   }
-  
-//////////////// START WRITING HTML AND DISPLAYING /////////////////
-  
-/*********** Fork for adding photos to html *********/
-
-#ifdef VERBOSE
-  printf("------%d forking for img add to html\n", index);
-#endif 
-  if (fork() == 0)
-    exit(img_html(thumb_name, med_name, index));
-
-//////////////////////////// DISPLAYING ///////////////////////////////
-
-  // Make sure thumbnail is resized already
+  else {
+    // Make sure thumbnail is resized already
 #ifdef VERBOSE
-  printf("---%d waiting for thumb resize\n", index);
+    printf("---%d waiting for thumb resize\n", index);
 #endif
-  waitpid(res_thumb, &status, 0);
+    if (read(ready[RPIPE], &receive, sizeof(int)) < 0)
+      fprintf(stderr, "error reading bytes from fanout process\n"); // keep going anyway, read data irrelavent
+    close(ready[RPIPE]);
 #ifdef VERBOSE
-  printf("---%d done waiting for thumb resize\n", index);
+    printf("---%d done waiting for thumb resize\n", index);
 #endif
+    display_name = thumb_name;
+  }
   
   // wait for previous img conversion process to finish
   // asking user before displaying next image,
@@ -513,7 +1063,7 @@ static int process_img(char* img, char* thumb_name, char* med_name, int index, i
 #endif
   printf("=============== %s ===============\n", img);
   printf("Please close the image to continue!\n");
-  dis_thumb = display(thumb_name);
+  dis_thumb = display(display_name);
 
 ///////////////////////////// ASKING ////////////////////////////
 
@@ -521,10 +1071,13 @@ static int process_img(char* img, char* thumb_name, char* med_name, int index, i
 #ifdef VERBOSE 
   printf("---%d waiting for thumb display\n", index);
 #endif
-  waitpid(dis_thumb, &status, 0);
+  if (dis_thumb > 0)
+    waitpid(dis_thumb, &status, 0);
 #ifdef VERBOSE
   printf("---%d done waiting for thumb display\n", index);
 #endif
+  if (display_name == preview_name)
+    remove(preview_name);
 
   /*********** asking to rotate ************/
 
@@ -534,23 +1087,33 @@ static int process_img(char* img, char* thumb_name, char* med_name, int index, i
   // parent in function only fetches rotate user input
   rot_dir = ask_user(sv1, sv2);
   
-  /************ Fork for rotating thumb and med **********/
+  /************ Rotating thumb and med **********/
 
-  // non-zero rot_dir means rotation is desired
-  if (rot_dir > 0) {
+  // fanout child holds the medium until it knows the rotation,
+  // then rotates (if rot_dir > 0) and writes it, and redoes the thumbnail
 #ifdef VERBOSE
-    printf("------%d forking for thumb rotate\n", index);
+  printf("---%d sending rotation %d to fanout\n", index, rot_dir);
 #endif
-    rotate(thumb_name, thumb_name, rot_dir);
-      
-#ifdef VERBOSE
-    printf("------%d forking for med rotate\n", index);
-#endif
-    // make sure the new filename for medium is there
-    // so that magick can open it
-    waitpid(res_med, &status, 0); 
-    rotate(med_name, med_name, rot_dir);
+  if (write(orient[WPIPE], &rot_dir, sizeof(int)) < 0)
+    fprintf(stderr, "error writing bytes to fanout process\n");
+
+  // the other formats asked for (-T, -M) are made from img, all at once,
+  // while the user writes the caption and the fanout writes the medium
+  memset(alts, 0, sizeof(alts));
+  memset(alt_pids, -1, sizeof(alt_pids));
+  magick_geometry(opts.thumb_size, geometry, sizeof(geometry));
+  transcode_all(img, thumb_name, geometry, rot_dir, &opts.thumb, alts[0], alt_pids[0]);
+  // only the engine makes the widths, and only those the photo is wider than
+  for (i = 0; opts.thumb.n > 0 && i < opts.nwidths && engine_probe(img, &src_width, &src_height) == 0; i++) {
+    char* name;
+    if (opts.widths[i] >= src_width || (name = level_name(thumb_name, opts.widths[i])) == NULL)
+      continue;
+    snprintf(geometry, sizeof(geometry), "%d", opts.widths[i]);
+    transcode_all(img, name, geometry, rot_dir, &opts.thumb, alts[i + 1], alt_pids[i + 1]);
+    free(name);
   }
+  magick_geometry(opts.med_size, geometry, sizeof(geometry));
+  transcode_all(img, med_name, geometry, rot_dir, &opts.med, meds, med_pids);
   
   /******** asking for caption ********/
 
@@ -559,51 +1122,232 @@ static int process_img(char* img, char* thumb_name, char* med_name, int index, i
   // ask_user child dies after function call
   ask_caption(sv1, sv2, caption);
 
-  /********** write caption to html *********/
-  if (cap_html(caption))
-    exit(-1);
-
 //////////////// SEND DATA TO NEXT PROCESS ////////////////////
 
-  // so next image can start writing html
-  send = index + 1;                 // set send signal that the next (IN INDEX ORDER) img (+1) can write  
-#if defined (VERBOSE) || (WAIT)           // this ensures only the next indexed img can write to html
-  printf("%d sending %d\n", index, send); // not just the next img that comes through processor
+  // so next image can start displaying
+  send = index + 1;
+#if defined (VERBOSE) || (WAIT)
+  printf("---%d writing that current img is done with caption to next img\n", index);
 #endif
-  if (write(html_out, &send, sizeof(int)) < 0) {
+  if (to_next >= 0 && write(to_next, &send, sizeof(int)) < 0) {
     fprintf(stderr, "error writing bytes out other img process. exiting...\n");
     exit(-1);
   }
 
-  // so next image can start displaying
+  // make sure the medium is written before this img process ends
+#ifdef VERBOSE
+  printf("---%d waiting for med and thumb finish\n", index);
+#endif
+  waitpid(res_both, &status, 0);
+
+  /********** send thumbnail, link and caption to html *********/
+
+  // the thumbnail is final now, its size goes in the html; the html
+  // writer commits the entry as soon as every earlier img's is in
+  entry.thumb_name = thumb_name;
+  entry.med_name = med_name;
+  entry.caption = caption;
+  entry.exif_rotate = opts.exif_rotate;
+  if (engine_probe(thumb_name, &entry.width, &entry.height) == 0 &&
+      opts.exif_rotate && rot_dir > 0 && engine_format(thumb_name) == FMT_JPEG &&
+      exif_get_orientation(thumb_name) == exif_orientation(rot_dir)) {
+    // only tagged (the pixels are turned when the tag can't be written):
+    // the browser turns it, so swap to the size it displays at
+    int t = entry.width;
+    entry.width = entry.height;
+    entry.height = t;
+    entry.turn = rot_dir;  // and a sprite sheet, which drops the tag, turns the pixels
+  }
+  if (opts.placeholders && lqip_uri(thumb_name, entry.turn, placeholder, sizeof(placeholder)) == 0)
+    entry.placeholder = placeholder;
+
+  // the photo at the widths that were made (-w), narrowest first, after the thumbnail
+  shown[nshown] = thumb_name;
+  levels[nshown] = 0;
+  widths[nshown++] = entry.width;
+  for (i = opts.nwidths - 1; i >= 0; i--) {
+    char* name = level_name(thumb_name, opts.widths[i]);
+    int w, h;
+    if (name != NULL && engine_probe(name, &w, &h) == 0) {
+      shown[nshown] = name;
+      levels[nshown] = i + 1;
+      widths[nshown++] = entry.turn > 0 ? h : w;
+    }
+    else
+      free(name);
+  }
+
+  // the browser picks the narrowest file that is wide enough for the screen
+  memset(srcsets, 0, sizeof(srcsets));
+  for (j = 0; nshown > 1 && j < nshown; j++)
+    add_candidate(srcsets[0], shown[j], widths[j]);
+  for (i = 0; i < opts.thumb.n; i++) {
+    for (j = 0; j < nshown; j++)
+      if (transcoded(&alt_pids[levels[j]][i]))
+	add_candidate(srcsets[i + 1], alts[levels[j]][i], nshown > 1 ? widths[j] : 0);
+    if (srcsets[i + 1][0] != '\0')
+      entry.sources[n++] = srcsets[i + 1];
+  }
+  // a width the engine didn't make after all has no use for its other formats
+  for (j = 0; j <= opts.nwidths; j++)
+    for (i = 0; i < opts.thumb.n; i++)
+      if (alt_pids[j][i] > 0) {
+	transcoded(&alt_pids[j][i]);
+	remove(alts[j][i]);
+      }
+  for (i = opts.med.n - 1; i >= 0; i--)
+    // the link can't fall back, so it goes to the best one there is
+    if (transcoded(&med_pids[i]))
+      entry.med_name = meds[i];
+  if (nshown > 1) {
+    entry.srcset = srcsets[0];
+    entry.display_width = widths[nshown - 1];
+  }
+  entry.sprite = opts.sprites;
+
 #if defined (VERBOSE) || (WAIT)
-  printf("---%d writing that current img is done with caption to next img\n", index);
+  printf("%d sending html\n", index);
 #endif
-  if (write(to_next, &send, sizeof(int)) < 0) {
-    fprintf(stderr, "error writing bytes out other img process. exiting...\n");
+  if (html_send(html_out, index, &entry))
     exit(-1);
-  }
+  for (j = 0; j <= opts.nwidths; j++)
+    for (i = 0; i < opts.thumb.n; i++)
+      free(alts[j][i]);
+  for (j = 1; j < nshown; j++)
+    free(shown[j]);
+  for (i = 0; i < opts.med.n; i++)
+    free(meds[i]);
+  launched = launch_count_end(launches);
+#ifdef VERBOSE
+  printf("---%d launched %d programs for %s\n", index, launched, img);
+#else
+  (void) launched;
+#endif
     
   printf("\n");
 //////////////// END OF THIS IMG CONVERSION PROCESS /////////////
   return 0;
 }
 
-/* Returns the number of concurrently-running
- * processes with waitpid() and WNOHANG option
+/* Blocks until one of the running image processes exits, the
+ * moment it does, and frees its slot. Other children (magick workers
+ * that died early) are reaped along the way and otherwise ignored.
  *
- * @param pid[] the array of child processes
- * @param len the len of the array
- * @return the number of currently-alive children
+ * @param running the pids of the running image processes, 0 for a free slot
+ * @param len the number of slots
+ * @return the freed slot, -1 if no image process is running
  */
-static int concurrent(int pid[], int len) {
-  int i, status, num = 0;
-  for (i = 0; i < len; i++) {
-    if (pid[i] != 0 && waitpid(pid[i], &status, WNOHANG) == 0)
-      num++;
+static int reap(int running[], int len) {
+  int i, pid, status, busy = 0;
+
+  // the magick workers outlive the images, don't block on them alone
+  for (i = 0; i < len; i++)
+    busy |= running[i] != 0;
+  while (busy && (pid = waitpid(-1, &status, 0)) > 0) {
+    for (i = 0; i < len; i++) {
+      if (running[i] == pid) {
+	running[i] = 0;
+	return i;
+      }
+    }
   }
+  return -1;
+}
 
-  return num;
+/* Picks the next img to start: the costliest of those not started
+ * yet among the window imgs from the first one not done. Every img
+ * waits its turn to be displayed, and holds its slot until then, so
+ * the imgs running always lie in the window; with the window as wide
+ * as the slots, the first img not done always has a slot and the turns
+ * keep moving, while a big img in the window starts before smaller ones.
+ *
+ * @param argc the img count
+ * @param started per img, 1 once forked
+ * @param first the first img not done
+ * @param window the number of slots
+ * @return the img, -1 if none in the window is left to start
+ */
+static int next_img(int argc, const int started[], int first, int window) {
+  int i, next = -1;
+  for (i = first; i < argc && i < first + window; i++)
+    if (!started[i] && (next < 0 || opts.costs[i] > opts.costs[next]))
+      next = i;
+  return next;
+}
+
+/* Keeps a descriptor out of the programs the image processes exec,
+ * e.g. magick display, so they never hold an img's turn or the writer's pipe
+ */
+static void cloexec(int fd) {
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+/* Creates the pipe from img i to img i + 1 unless it exists,
+ * the one the img after uses to know when to display
+ *
+ * @param chain the pipes, -1 ends for those not created yet, -2 for those closed
+ * @return -1 on error, 0 on success
+ */
+static int link_imgs(int chain[][2], int i) {
+  if (chain[i][RPIPE] != -1)
+    return 0;
+  if (pipe(chain[i]) != 0) {
+    chain[i][RPIPE] = chain[i][WPIPE] = -1;
+    return -1;
+  }
+  cloexec(chain[i][RPIPE]);
+  cloexec(chain[i][WPIPE]);
+  return 0;
+}
+
+/* Works out how many imgs to convert at once, unless -j says:
+ * one per cpu the album may use, plus one, as an img spends most of
+ * its time waiting on the user once its thumbnail is shown; but only
+ * as many as fit in memory at the costliest img's estimated peak
+ *
+ * @param argc the img count
+ * @param argv the imgs
+ * @return the number of slots, at least 1
+ */
+static int conversions(int argc, char* argv[]) {
+  long memory = quota_memory(), peak = 0, need;
+  int i, cpus = quota_cpus(), slots = cpus + 1;
+
+  for (i = 0; i < argc; i++) {
+    long decode = opts.costs[i] < ENGINE_STREAM_PIXELS * 4 ? opts.costs[i] : ENGINE_STREAM_PIXELS * 4;
+
+    // magick holds 16-bit rgba, twice over
+    if (engine_format(argv[i]) == FMT_UNKNOWN) {
+      need = opts.costs[i] * 6;
+      if (need > peak)
+	peak = need;
+      continue;
+    }
+    // the engine holds about the decode, which is streamed past ENGINE_STREAM_PIXELS,
+    // and the medium; with -w, the decode is held while the widths are made
+    // from it, and they take about as much again
+    need = 2 * decode;
+    if (opts.nwidths > 0)
+      need += decode;
+    // with -k, each trial encode is a process of its own, whose output
+    // can grow to about the size of the raster
+    if (opts.thumb.jpg.budget > 0 || opts.med.jpg.budget > 0)
+      need += ENGINE_TRIALS * (decode + IMG_OVERHEAD);
+    if (need > peak)
+      peak = need;
+  }
+  peak += IMG_OVERHEAD;
+  if (memory > 0 && memory / peak < slots)
+    slots = (int) (memory / peak);
+  if (slots > argc)
+    slots = argc;
+  if (slots < 1)
+    slots = 1;
+#ifdef VERBOSE
+  printf("converting %d images at once: %d cpus, %ld MB of memory, about %ld MB per image\n",
+	 slots, cpus, memory >> 20, peak >> 20);
+#endif
+  return slots;
 }
 
 /* Manages all processes, and at the top-level,
@@ -611,66 +1355,162 @@ static int concurrent(int pid[], int len) {
  * Will exit(-1) from function if error, exit(0) from
  * the child process when a singular image-conversion is completed.
  *
- * @param argc the arg count
- * @param argv the args
+ * @param argc the img count
+ * @param argv the imgs, options already stripped
  * @return 0
  */
 static int process(int argc, char* argv[]) {
   printf("Image Processing will begin now...\n\n");
-  
-  argc--; // for convenience to get actual number of args
-  argv++; // move argv forward too;
 
-  int i, status;
-  int pid[argc]; // stores all the pids of its children
-  int ptp1[2], ptp2[2];
-  
-  // create pipe and validate its creation
-  if (pipe(ptp1) != 0 || pipe(ptp2) != 0){
+  int i, j, slot, writer, status, unhandled = 0, forked = 0, first = 0;
+  int max_conversions = opts.jobs > 0 ? opts.jobs : conversions(argc, argv);
+  int* running; // pids of the running image processes, one slot each
+  int* slot_img; // the img each slot runs
+  int html[2];
+  int (*chain)[2]; // chain[i]: the pipe from img i to img i + 1, created once either is forked
+  int* started, *done;
+
+  running = (int*) calloc(max_conversions, sizeof(int));
+  slot_img = (int*) calloc(max_conversions, sizeof(int));
+  started = (int*) calloc(argc, sizeof(int));
+  done = (int*) calloc(argc, sizeof(int));
+  chain = (int (*)[2]) malloc(argc * sizeof(*chain));
+  if (running == NULL || slot_img == NULL || started == NULL || done == NULL || chain == NULL)
+    return -1;
+  for (i = 0; i < argc; i++)
+    chain[i][RPIPE] = chain[i][WPIPE] = -1;
+
+  // one process writes index.html, in image order, from what the images send it
+  if (pipe(html) != 0) {
     fprintf(stderr, "failed to create a pipe\n");
     return -1;
   }
+  if ((writer = fork()) == 0) {
+    layout_t layout = {argc, opts.page_size, opts.sprites, opts.precompress};
+    close(html[WPIPE]);
+    exit(html_writer(html[RPIPE], &layout));
+  }
+  close(html[RPIPE]);
+  cloexec(html[WPIPE]);  // keep it from magick, or the writer never sees the end
 
-  for (i = 0; i < argc; i++) {
-    int num, max_conversions = 3; // change this number to your liking
-    while ((num = concurrent(pid, argc)) >= max_conversions)
-      sleep(1); // let the next process run if max running is met
-    
-    pid[i] = fork();
-    if (pid[i] == 0) {      
+  // images the engine can't decode go to magick, and so does every
+  // image with a format it can't write (-T, -M); keep workers warm for them
+  for (i = 0; i < argc; i++)
+    if (engine_format(argv[i]) == FMT_UNKNOWN || opts.thumb.n > 0 || opts.med.n > 0)
+      unhandled++;
+  launch_init();  // look magick up on PATH once, for every image
+  if (unhandled > 0 && pool_start(&pool, unhandled < max_conversions ? unhandled : max_conversions) != 0)
+    fprintf(stderr, "failed to start magick workers, will exec magick per image\n");
+  
+  while (forked < argc) {
+    // take a free slot and the biggest img it may start, or wait for
+    // an img to finish: the next starts the instant one frees
+    for (slot = 0; slot < max_conversions && running[slot] != 0; slot++)
+      ;
+    i = slot < max_conversions ? next_img(argc, started, first, max_conversions) : -1;
+    if (i < 0) {
+      if ((slot = reap(running, max_conversions)) < 0) {
+	fprintf(stderr, "lost track of the image processes\n");
+	return -1;
+      }
+      for (done[slot_img[slot]] = 1; first < argc && done[first]; first++)
+	;
+      continue;
+    }
+
+    // each img gets its own pipe from the one before and to the one after,
+    // so it displays once the img before it is done, and only then
+    // (a shared pipe lets any img grab the turn; the last img has no next,
+    // and writing to a pipe nobody reads would kill it)
+    if ((i > 0 && link_imgs(chain, i - 1)) || (i < argc - 1 && link_imgs(chain, i))) {
+      fprintf(stderr, "failed to create a pipe\n");
+      break;
+    }
+#ifdef VERBOSE
+    printf("starting %s (%ld), %d of %d\n", argv[i], opts.costs[i], forked + 1, argc);
+#endif
+    if ((running[slot] = fork()) < 0) {
+      fprintf(stderr, "failed to fork an image process\n");
+      running[slot] = 0;
+      break;
+    }
+    if (running[slot] == 0) {      
       char* path = argv[i];
       char* img;
+      int from_prev = i > 0 ? chain[i - 1][RPIPE] : -1;
+      int to_next = i < argc - 1 ? chain[i][WPIPE] : -1;
+
+      // only its own ends of the chain stay open; the parent holds ends
+      // only of pipes next to started imgs, which all lie in the window
+      for (j = first > 0 ? first - 1 : 0; j < argc - 1 && j < first + max_conversions; j++) {
+	if (chain[j][RPIPE] >= 0 && chain[j][RPIPE] != from_prev)
+	  close(chain[j][RPIPE]);
+	if (chain[j][WPIPE] >= 0 && chain[j][WPIPE] != to_next)
+	  close(chain[j][WPIPE]);
+      }
   
       if ((img = strrchr(path, '/')) != NULL)
 	img++; // move image past '/' character
       else
 	img = path;
       
-      // thumb_name = "thumb_photoname", med_name = "med_photoname"
+      // thumb_name = "thumb_photoname", med_name = "med_photoname", preview_name = "preview_photoname"
       char* thumb_name = (char*) malloc((strlen("thumb_") + strlen(img) + 1) * sizeof(char));
       char* med_name = (char*) malloc((strlen("med_") + strlen(img) + 1) * sizeof(char));
+      char* preview_name = (char*) malloc((strlen("preview_") + strlen(img) + 1) * sizeof(char));
       
       strcpy(thumb_name, "thumb_");
       strcpy(med_name, "med_");	
+      strcpy(preview_name, "preview_");
       strcat(thumb_name, img);
       strcat(med_name, img);
+      strcat(preview_name, img);
 
 #ifdef VERBOSE
       printf("begin process on %s\n", path);
 #endif
-      process_img(path, thumb_name, med_name, i, ptp1, ptp2);
+      process_img(path, thumb_name, med_name, preview_name, i, from_prev, to_next, html[WPIPE]);
       
       free(thumb_name);
       free(med_name);
+      free(preview_name);
 
       exit(0);
     }
+
+    // the img's own ends are its alone now; the other ends wait for its neighbours
+    slot_img[slot] = i;
+    started[i] = 1;
+    forked++;
+    if (i > 0) {
+      close(chain[i - 1][RPIPE]);
+      chain[i - 1][RPIPE] = -2;
+    }
+    if (i < argc - 1) {
+      close(chain[i][WPIPE]);
+      chain[i][WPIPE] = -2;
+    }
   }
+  // ends left by an img that never started
+  for (i = 0; i < argc - 1; i++) {
+    if (chain[i][RPIPE] >= 0)
+      close(chain[i][RPIPE]);
+    if (chain[i][WPIPE] >= 0)
+      close(chain[i][WPIPE]);
+  }
+  free(chain);
+  free(started);
+  free(done);
     
   // wait to end main until all children are dead
   // to prevent stdin from closing
-  for (i = 0; i < argc; i++)
-    waitpid(pid[i], &status, 0);
+  while (reap(running, max_conversions) >= 0)
+    ;
+  free(running);
+  free(slot_img);
+  close(html[WPIPE]);
+  waitpid(writer, &status, 0);  // index.html is complete once the writer is done
+  pool_stop(&pool);
 
   printf("=============== END OF PHOTO CONVERSION ===============\n");
   printf("Digital Photo Album is Complete!\n'index.html' album and all edited images are in your current directory.\n");
@@ -689,5 +1529,5 @@ int main(int argc, char* argv[]) {
   if (validate(argc, argv))
     return -1;
 
-  return process(argc, argv);
+  return process(argc - optind, argv + optind);
 }
@@ -0,0 +1,1681 @@
+/* engine.c
+ * 15 October 2026
+ * An in-process image engine, so that resize() does not have to exec
+ * a whole ImageMagick process per output. Decodes jpg (libjpeg) and
+ * png (libpng), resamples with a separable filter (resample.c), and encodes
+ * back to the same format. Anything it can't handle returns -1 so the
+ * caller can fall back on magick.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // open_memstream() under -std=c11
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <jpeglib.h>
+#include <png.h>
+#include "engine.h"
+#include "exif.h"
+#include "resample.h"
+
+/* libjpeg calls error_exit() on a fatal error, which by default
+ * exit()s the whole process. Jump back to the caller instead.
+ */
+struct jpeg_err {
+  struct jpeg_error_mgr mgr;
+  jmp_buf jump;
+};
+
+static void jpeg_err_exit(j_common_ptr cinfo) {
+  struct jpeg_err* err = (struct jpeg_err*) cinfo->err;
+  longjmp(err->jump, 1);
+}
+
+/* Identifies the image format from the file's magic bytes
+ *
+ * @param path the file path
+ * @return FMT_JPEG, FMT_PNG, or FMT_UNKNOWN for anything else
+ */
+int engine_format(const char* path) {
+  FILE* fp;
+  unsigned char bytes[8] = {0};
+
+  if ((fp = fopen(path, "rb")) == NULL)
+    return FMT_UNKNOWN;
+  if (fread(bytes, 8, 1, fp) != 1)
+    bytes[0] = 0;
+  fclose(fp);
+
+  if (bytes[0] == 0xff && bytes[1] == 0xd8)
+    return FMT_JPEG;
+  if (png_sig_cmp(bytes, 0, 8) == 0)
+    return FMT_PNG;
+  return FMT_UNKNOWN;
+}
+
+/* Picks the libjpeg DCT scaling (1/denom) that decodes a jpg
+ * straight to the smallest size still at least percent of it,
+ * so the pixels a resize would throw away are never decoded
+ *
+ * @param width the jpg's width
+ * @param height the jpg's height
+ * @param percent the size that will be made from the decode
+ * @return the denominator: 8, 4, 2 or 1
+ */
+static int dct_denom(int width, int height, double percent) {
+  int denom;
+  for (denom = 8; denom > 1; denom /= 2) {
+    if ((width + denom - 1) / denom >= engine_scaled(width, percent) &&
+	(height + denom - 1) / denom >= engine_scaled(height, percent))
+      break;
+  }
+  return denom;
+}
+
+/* Whether a decode is big enough to be streamed into the
+ * resampler (see resample_stream_start()) rather than held whole
+ *
+ * @param dec_width the decoded width
+ * @param dec_height the decoded height
+ * @param width the target width
+ * @param height the target height
+ * @return 1 to stream, 0 to decode whole
+ */
+static int streams(int dec_width, int dec_height, int width, int height) {
+  return (long) dec_width * dec_height > ENGINE_STREAM_PIXELS && (dec_width != width || dec_height != height);
+}
+
+/* Decodes a jpg into an rgb or gray raster, scaled
+ * down in the DCT domain as far as percent allows.
+ * A decode bigger than ENGINE_STREAM_PIXELS is resampled row
+ * by row as it comes out, straight to percent of the jpg's size.
+ *
+ * @param path the jpg to decode
+ * @param r the raster to fill
+ * @param percent the size that will be made from the decode, 100 for full size
+ * @param width set to the jpg's full width
+ * @param height set to the jpg's full height
+ * @return -1 on error, 0 on success
+ */
+static int decode_jpeg(const char* path, raster_t* r, double percent, int* width, int* height) {
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_err err;
+  stream_t s = {0};
+  unsigned char* volatile row = NULL;
+  FILE* fp;
+
+  if ((fp = fopen(path, "rb")) == NULL)
+    return -1;
+
+  r->pixels = NULL;
+  cinfo.err = jpeg_std_error(&err.mgr);
+  err.mgr.error_exit = jpeg_err_exit;
+  if (setjmp(err.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    fclose(fp);
+    resample_stream_free(&s);
+    free(row);
+    free(r->pixels);
+    r->pixels = NULL;
+    return -1;
+  }
+
+  jpeg_create_decompress(&cinfo);
+  jpeg_stdio_src(&cinfo, fp);
+  jpeg_read_header(&cinfo, TRUE);
+
+  // cmyk/ycck sources are left to magick, which knows about color profiles
+  if (cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+    jpeg_destroy_decompress(&cinfo);
+    fclose(fp);
+    return -1;
+  }
+  cinfo.out_color_space = cinfo.num_components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = dct_denom(cinfo.image_width, cinfo.image_height, percent);
+  *width = cinfo.image_width;
+  *height = cinfo.image_height;
+  jpeg_start_decompress(&cinfo);
+
+  if (streams(cinfo.output_width, cinfo.output_height, engine_scaled(*width, percent), engine_scaled(*height, percent))) {
+    if ((row = (unsigned char*) malloc((size_t) cinfo.output_width * cinfo.output_components)) == NULL ||
+	resample_stream_start(&s, cinfo.output_width, cinfo.output_height, cinfo.output_components, r,
+			      engine_scaled(*width, percent), engine_scaled(*height, percent), ENGINE_FILTER))
+      longjmp(err.jump, 1);
+    while (cinfo.output_scanline < cinfo.output_height) {
+      JSAMPROW in = row;
+      jpeg_read_scanlines(&cinfo, &in, 1);
+      resample_stream_push(&s, row);
+    }
+    resample_stream_free(&s);
+    free(row);
+    row = NULL;
+  }
+  else {
+    r->width = cinfo.output_width;
+    r->height = cinfo.output_height;
+    r->channels = cinfo.output_components;
+    r->pixels = (unsigned char*) malloc((size_t) r->width * r->height * r->channels);
+    if (r->pixels == NULL)
+      longjmp(err.jump, 1);
+
+    while (cinfo.output_scanline < cinfo.output_height) {
+      JSAMPROW in = r->pixels + (size_t) cinfo.output_scanline * r->width * r->channels;
+      jpeg_read_scanlines(&cinfo, &in, 1);
+    }
+  }
+
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  fclose(fp);
+  return 0;
+}
+
+/* Streams a big non-interlaced png into the resampler row
+ * by row (libpng's row API; the simplified one reads whole images)
+ *
+ * @param path the png to decode
+ * @param r the raster to fill, at width x height
+ * @param width the target width
+ * @param height the target height
+ * @return -1 on error, 0 on success
+ */
+static int stream_png(const char* path, raster_t* r, int width, int height) {
+  png_structp png;
+  png_infop info;
+  stream_t s = {0};
+  unsigned char* volatile row = NULL;
+  FILE* fp;
+  int y;
+
+  r->pixels = NULL;
+  if ((fp = fopen(path, "rb")) == NULL)
+    return -1;
+  if ((png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL)) == NULL ||
+      (info = png_create_info_struct(png)) == NULL) {
+    png_destroy_read_struct(&png, NULL, NULL);
+    fclose(fp);
+    return -1;
+  }
+  if (setjmp(png_jmpbuf(png))) {
+    png_destroy_read_struct(&png, &info, NULL);
+    fclose(fp);
+    resample_stream_free(&s);
+    free(row);
+    return -1;
+  }
+
+  png_init_io(png, fp);
+  png_read_info(png, info);
+  if (png_get_interlace_type(png, info) != PNG_INTERLACE_NONE)
+    png_error(png, "interlaced");
+
+  // the same rgb or rgba the simplified API makes
+  png_set_expand(png);
+  png_set_strip_16(png);
+  png_set_gray_to_rgb(png);
+  png_read_update_info(png, info);
+
+  if ((row = (unsigned char*) malloc(png_get_rowbytes(png, info))) == NULL ||
+      resample_stream_start(&s, png_get_image_width(png, info), png_get_image_height(png, info),
+			    png_get_channels(png, info), r, width, height, ENGINE_FILTER))
+    png_error(png, "out of memory");
+  for (y = 0; y < (int) png_get_image_height(png, info); y++) {
+    png_read_row(png, row, NULL);
+    resample_stream_push(&s, row);
+  }
+  resample_stream_free(&s);
+
+  png_destroy_read_struct(&png, &info, NULL);
+  fclose(fp);
+  free(row);
+  return 0;
+}
+
+/* Decodes a png into an rgb or rgba raster, depending on whether
+ * the png carries alpha. A png bigger than ENGINE_STREAM_PIXELS is
+ * streamed straight to percent of its size, see stream_png().
+ *
+ * @param path the png to decode
+ * @param r the raster to fill
+ * @param percent the size that will be made from the decode, 100 for full size
+ * @param width set to the png's full width
+ * @param height set to the png's full height
+ * @return -1 on error, 0 on success
+ */
+static int decode_png(const char* path, raster_t* r, double percent, int* width, int* height) {
+  png_image image;
+
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  if (!png_image_begin_read_from_file(&image, path))
+    return -1;
+  *width = image.width;
+  *height = image.height;
+
+  if (streams(*width, *height, engine_scaled(*width, percent), engine_scaled(*height, percent))) {
+    png_image_free(&image);
+    if (stream_png(path, r, engine_scaled(*width, percent), engine_scaled(*height, percent)) == 0)
+      return 0;
+    // interlaced: read it whole after all
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, path))
+      return -1;
+  }
+
+  image.format = (image.format & PNG_FORMAT_FLAG_ALPHA) ? PNG_FORMAT_RGBA : PNG_FORMAT_RGB;
+  r->width = image.width;
+  r->height = image.height;
+  r->channels = PNG_IMAGE_SAMPLE_CHANNELS(image.format);
+  if ((r->pixels = (unsigned char*) malloc(PNG_IMAGE_SIZE(image))) == NULL) {
+    png_image_free(&image);
+    return -1;
+  }
+
+  if (!png_image_finish_read(&image, NULL, r->pixels, 0, NULL)) {
+    free(r->pixels);
+    r->pixels = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+/* Reads the dimensions of an image from its header alone,
+ * without decoding any pixels
+ *
+ * @param path the image
+ * @param width set to the image's width
+ * @param height set to the image's height
+ * @return -1 if the format is unsupported or on error, 0 on success
+ */
+int engine_probe(const char* path, int* width, int* height) {
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_err err;
+  png_image image;
+  FILE* fp;
+
+  switch (engine_format(path)) {
+  case FMT_JPEG:
+    if ((fp = fopen(path, "rb")) == NULL)
+      return -1;
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpeg_err_exit;
+    if (setjmp(err.jump)) {
+      jpeg_destroy_decompress(&cinfo);
+      fclose(fp);
+      return -1;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, fp);
+    jpeg_read_header(&cinfo, TRUE);
+    *width = cinfo.image_width;
+    *height = cinfo.image_height;
+    jpeg_destroy_decompress(&cinfo);
+    fclose(fp);
+    return 0;
+  case FMT_PNG:
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, path))
+      return -1;
+    *width = image.width;
+    *height = image.height;
+    png_image_free(&image);
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+/* Estimates the quality a jpg was written at from its luminance
+ * quantization table, by undoing libjpeg's scaling of the standard
+ * table, much as ImageMagick does to keep a jpg's quality
+ *
+ * @param cinfo the decompression, its header read
+ * @return the quality, JPEG_QUALITY if there is no table
+ */
+static int estimate_quality(const struct jpeg_decompress_struct* cinfo) {
+  static const int std_luma[DCTSIZE2] = {
+    16,  11,  10,  16,  24,  40,  51,  61,
+    12,  12,  14,  19,  26,  58,  60,  55,
+    14,  13,  16,  24,  40,  57,  69,  56,
+    14,  17,  22,  29,  51,  87,  80,  62,
+    18,  22,  37,  56,  68, 109, 103,  77,
+    24,  35,  55,  64,  81, 104, 113,  92,
+    49,  64,  78,  87, 103, 121, 120, 101,
+    72,  92,  95,  98, 112, 100, 103,  99
+  };
+  const JQUANT_TBL* q = cinfo->quant_tbl_ptrs[0];
+  long sum = 0, std = 0;
+  double scale;
+  int i, quality;
+
+  if (q == NULL)
+    return JPEG_QUALITY;
+  for (i = 0; i < DCTSIZE2; i++) {
+    sum += q->quantval[i];
+    std += std_luma[i];
+  }
+  // jpeg_quality_scaling(): 5000 / quality below 50, 200 - 2 * quality from 50
+  scale = 100.0 * sum / std;
+  quality = (int) (scale <= 100 ? (200 - scale) / 2 + 0.5 : 5000 / scale + 0.5);
+  return quality < 1 ? 1 : quality > 100 ? 100 : quality;
+}
+
+/* Reads what a jpg's outputs keep of it from its header alone: its
+ * quality, so they aren't written at a higher one than it has, and
+ * its EXIF segment, which each output keeps a little of, see
+ * keep_source(). Anything else gets JPEG_QUALITY and no EXIF.
+ *
+ * @param path the image
+ * @param s filled in, released with engine_source_free()
+ * @return -1 on error, 0 on success
+ */
+int engine_source(const char* path, source_t* s) {
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_err err;
+  jpeg_saved_marker_ptr m;
+  FILE* fp;
+
+  s->quality = JPEG_QUALITY;
+  s->app1 = NULL;
+  s->app1_len = 0;
+  if (engine_format(path) != FMT_JPEG)
+    return 0;
+  if ((fp = fopen(path, "rb")) == NULL)
+    return -1;
+  cinfo.err = jpeg_std_error(&err.mgr);
+  err.mgr.error_exit = jpeg_err_exit;
+  if (setjmp(err.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    fclose(fp);
+    engine_source_free(s);
+    return -1;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_stdio_src(&cinfo, fp);
+  jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xffff);
+  jpeg_read_header(&cinfo, TRUE);
+  s->quality = estimate_quality(&cinfo);
+  for (m = cinfo.marker_list; m != NULL; m = m->next) {
+    if (m->marker != JPEG_APP0 + 1 || m->data_length < 6 || memcmp(m->data, "Exif\0\0", 6) != 0)
+      continue;
+    if ((s->app1 = (unsigned char*) malloc(m->data_length)) != NULL) {
+      memcpy(s->app1, m->data, m->data_length);
+      s->app1_len = m->data_length;
+    }
+    break;
+  }
+  jpeg_destroy_decompress(&cinfo);
+  fclose(fp);
+  return 0;
+}
+
+/* Releases what engine_source() read
+ *
+ * @param s the source
+ */
+void engine_source_free(source_t* s) {
+  free(s->app1);
+  s->app1 = NULL;
+  s->app1_len = 0;
+}
+
+/* Decodes an image file into memory, possibly at reduced
+ * resolution: the raster is at least percent of the image's
+ * size, but can be smaller than the full image (jpg DCT scaling,
+ * or a big decode streamed straight to percent)
+ *
+ * @param path the image to decode
+ * @param r the raster to fill, released with engine_free()
+ * @param percent the size that will be made from the decode, 100 for full size
+ * @param width set to the image's full width
+ * @param height set to the image's full height
+ * @return -1 if the format is unsupported or on error, 0 on success
+ */
+int engine_decode_at(const char* path, raster_t* r, double percent, int* width, int* height) {
+  switch (engine_format(path)) {
+  case FMT_JPEG:
+    return decode_jpeg(path, r, percent, width, height);
+  case FMT_PNG:
+    return decode_png(path, r, percent, width, height);
+  default:
+    return -1;
+  }
+}
+
+/* Decodes an image file into memory at full size
+ *
+ * @param path the image to decode
+ * @param r the raster to fill, released with engine_free()
+ * @return -1 if the format is unsupported or on error, 0 on success
+ */
+int engine_decode(const char* path, raster_t* r) {
+  int width, height;
+  return engine_decode_at(path, r, 100, &width, &height);
+}
+
+/* The quality a jpg is written at
+ *
+ * @param o how to write the jpg, NULL for a baseline jpg at JPEG_QUALITY
+ * @return the quality, 1 to 100
+ */
+static int opts_quality(const jpeg_opts_t* o) {
+  if (o == NULL)
+    return JPEG_QUALITY;
+  if (o->quality > 0)
+    return o->quality;
+  return o->source != NULL ? o->source->quality : JPEG_QUALITY;
+}
+
+/* Writes what a jpg being written keeps of its source's EXIF segment,
+ * with the Orientation asked for, right after the JFIF header libjpeg
+ * writes. It is part of the encode, so -k trials count its bytes.
+ *
+ * @param cinfo the compression, started
+ * @param o how to write the jpg
+ */
+static void keep_source(struct jpeg_compress_struct* cinfo, const jpeg_opts_t* o) {
+  unsigned char exif[EXIF_MAX];
+  long len;
+
+  if (o == NULL)
+    return;
+  len = o->source != NULL ?
+    exif_trim(o->source->app1, o->source->app1_len, o->exif, o->orientation, exif) :
+    exif_trim(NULL, 0, o->exif, o->orientation, exif);
+  if (len > 0)
+    jpeg_write_marker(cinfo, JPEG_APP0 + 1, exif, len);
+}
+
+/* Applies the quality and scan layout asked for to a jpg about to be
+ * written. Call it after the color space and sampling are set, which
+ * the progressive scans are laid out for.
+ *
+ * @param cinfo the compressor
+ * @param o how to write the jpg, NULL for a baseline jpg at JPEG_QUALITY
+ */
+static void jpeg_tune(struct jpeg_compress_struct* cinfo, const jpeg_opts_t* o) {
+  jpeg_set_quality(cinfo, opts_quality(o), TRUE);
+  if (o != NULL && o->progressive) {
+    jpeg_simple_progression(cinfo);
+    cinfo->optimize_coding = TRUE;
+  }
+}
+
+/* Writes a raster as a jpg
+ *
+ * @param r the raster, 1 or 3 channels
+ * @param fp the stream to write to
+ * @param o how to write the jpg, NULL for a baseline jpg at JPEG_QUALITY
+ * @return -1 on error, 0 on success
+ */
+static int write_jpeg(const raster_t* r, FILE* fp, const jpeg_opts_t* o) {
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_err err;
+
+  if (r->channels != 1 && r->channels != 3)
+    return -1;
+
+  cinfo.err = jpeg_std_error(&err.mgr);
+  err.mgr.error_exit = jpeg_err_exit;
+  if (setjmp(err.jump)) {
+    jpeg_destroy_compress(&cinfo);
+    return -1;
+  }
+
+  jpeg_create_compress(&cinfo);
+  jpeg_stdio_dest(&cinfo, fp);
+  cinfo.image_width = r->width;
+  cinfo.image_height = r->height;
+  cinfo.input_components = r->channels;
+  cinfo.in_color_space = r->channels == 1 ? JCS_GRAYSCALE : JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_tune(&cinfo, o);
+  jpeg_start_compress(&cinfo, TRUE);
+  keep_source(&cinfo, o);
+
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW row = r->pixels + (size_t) cinfo.next_scanline * r->width * r->channels;
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  return 0;
+}
+
+/* Encodes a raster as a small jpg in memory, with Huffman tables
+ * optimized for it and no JFIF marker, since for a tiny image the
+ * headers outweigh the pixels
+ *
+ * @param r the raster, 1 or 3 channels
+ * @param quality the jpg quality, 1 to 100
+ * @param out filled with the jpg, released with free()
+ * @param len filled with the length of out
+ * @return -1 on error, 0 on success
+ */
+int engine_encode_mem(const raster_t* r, int quality, unsigned char** out, unsigned long* len) {
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_err err;
+
+  *out = NULL;
+  *len = 0;
+  if (r->channels != 1 && r->channels != 3)
+    return -1;
+
+  cinfo.err = jpeg_std_error(&err.mgr);
+  err.mgr.error_exit = jpeg_err_exit;
+  if (setjmp(err.jump)) {
+    jpeg_destroy_compress(&cinfo);
+    free(*out);
+    *out = NULL;
+    return -1;
+  }
+
+  jpeg_create_compress(&cinfo);
+  jpeg_mem_dest(&cinfo, out, len);
+  cinfo.image_width = r->width;
+  cinfo.image_height = r->height;
+  cinfo.input_components = r->channels;
+  cinfo.in_color_space = r->channels == 1 ? JCS_GRAYSCALE : JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  cinfo.optimize_coding = TRUE;
+  cinfo.write_JFIF_header = FALSE;  // the defaults it records are what a decoder assumes anyway
+  jpeg_start_compress(&cinfo, TRUE);
+
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW row = r->pixels + (size_t) cinfo.next_scanline * r->width * r->channels;
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  return 0;
+}
+
+/* Encodes a raster as a png
+ *
+ * @param r the raster, 3 or 4 channels
+ * @param path the file to write
+ * @return -1 on error, 0 on success
+ */
+static int encode_png(const raster_t* r, const char* path) {
+  png_image image;
+
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  image.width = r->width;
+  image.height = r->height;
+  if (r->channels == 1)
+    image.format = PNG_FORMAT_GRAY;
+  else if (r->channels == 3)
+    image.format = PNG_FORMAT_RGB;
+  else
+    image.format = PNG_FORMAT_RGBA;
+
+  return png_image_write_to_file(&image, path, 0, r->pixels, 0, NULL) ? 0 : -1;
+}
+
+/* Encodes a raster to an image file
+ *
+ * @param r the raster
+ * @param path the file to write
+ * @param format FMT_JPEG or FMT_PNG
+ * @return -1 on error, 0 on success
+ */
+int engine_encode(const raster_t* r, const char* path, int format) {
+  FILE* fp;
+  int ret;
+
+  switch (format) {
+  case FMT_JPEG:
+    if ((fp = fopen(path, "wb")) == NULL)
+      return -1;
+    ret = write_jpeg(r, fp, NULL);
+    if (fclose(fp) != 0)
+      ret = -1;
+    return ret;
+  case FMT_PNG:
+    return encode_png(r, path);
+  default:
+    return -1;
+  }
+}
+
+/* Releases the pixels of a raster
+ *
+ * @param r the raster
+ */
+void engine_free(raster_t* r) {
+  free(r->pixels);
+  r->pixels = NULL;
+}
+
+/* Resamples a raster to the given dimensions with the
+ * engine's filter (ENGINE_FILTER), see resample()
+ *
+ * @param src the source raster
+ * @param dst the raster to fill, released with engine_free()
+ * @param width the destination width
+ * @param height the destination height
+ * @return -1 on error, 0 on success
+ */
+int engine_resample(const raster_t* src, raster_t* dst, int width, int height) {
+  // exact 4:1 and 5:2 reductions (25%, and 10% from 25%) have integer kernels
+  if (resample_fixed(src, dst, width, height) == 0)
+    return 0;
+  return resample(src, dst, width, height, ENGINE_FILTER);
+}
+
+/* Brings a decode to the target size: passes the raster
+ * through if the decode already landed on it, else resamples
+ *
+ * @param src the decoded raster, taken over (freed or moved into dst)
+ * @param dst the raster to fill, released with engine_free()
+ * @param width the target width
+ * @param height the target height
+ * @return -1 on error, 0 on success
+ */
+static int finish_decode(raster_t* src, raster_t* dst, int width, int height) {
+  int ret = 0;
+  if (src->width == width && src->height == height) {
+    *dst = *src;
+    src->pixels = NULL;
+  }
+  else
+    ret = engine_resample(src, dst, width, height);
+  engine_free(src);
+  return ret;
+}
+
+/* Scales a dimension by a percentage the way magick's
+ * geometry does, rounding to nearest and never below 1
+ *
+ * @param len the source length
+ * @param percent the percentage
+ * @return the scaled length
+ */
+int engine_scaled(int len, double percent) {
+  int scaled = (int) floor(len * percent / 100.0 + 0.5);
+  return scaled < 1 ? 1 : scaled;
+}
+
+/* Works out the percentage a size scales an image by. A size is
+ *   "25%"      a percentage of the image
+ *   "320x240"  the largest that fits within 320x240
+ *   "320"      a long edge of 320
+ * A box or a long edge never scales an image up.
+ *
+ * @param size the size
+ * @param width the image's width (not needed for a percentage)
+ * @param height the image's height
+ * @return the percentage, or -1 if size is not a size
+ */
+double engine_percent(const char* size, int width, int height) {
+  char* end;
+  long box_w, box_h;
+  double fit;
+
+  if (size[0] == '\0' || size[strlen(size) - 1] == '%') {
+    double percent = strtod(size, &end);
+    return percent > 0 && end == size + strlen(size) - 1 ? percent : -1;
+  }
+
+  box_w = strtol(size, &end, 10);
+  if (box_w <= 0 || end == size)
+    return -1;
+  if (*end == 'x') {
+    char* h = end + 1;
+    box_h = strtol(h, &end, 10);
+    if (box_h <= 0 || end == h)
+      return -1;
+  }
+  else
+    box_h = box_w;  // a long edge is a square box
+  if (*end != '\0' || width <= 0 || height <= 0)
+    return -1;
+
+  fit = (double) box_w / width < (double) box_h / height ? (double) box_w / width : (double) box_h / height;
+  return fit >= 1 ? 100 : 100 * fit;
+}
+
+/* Works out the percentage a size scales img by, reading its
+ * dimensions from its header only if the size needs them
+ *
+ * @param img the image
+ * @param size the size, see engine_percent()
+ * @param width the image's width, read on the first call that needs it (0 until then)
+ * @param height the image's height
+ * @return the percentage, or -1 if size is not a size or img can't be read
+ */
+static double size_percent(const char* img, const char* size, int* width, int* height) {
+  if (size[0] != '\0' && size[strlen(size) - 1] != '%' && *width == 0 && engine_probe(img, width, height))
+    return -1;
+  return engine_percent(size, *width, *height);
+}
+
+/* Resizes an image in-process, the engine equivalent of
+ * "magick convert -resize size img rename". The output
+ * keeps the format of the input, and a jpg's quality and Orientation.
+ *
+ * @param img the image to resize
+ * @param rename the file to write the resized image to
+ * @param size the size, see engine_percent()
+ * @return -1 if the engine can't handle img (caller should
+ *         fall back on magick), 0 on success
+ */
+int engine_resize(char* img, char* rename, char* size) {
+  raster_t src, dst;
+  source_t source;
+  int format = engine_format(img);
+  int width = 0, height = 0, ret;
+  double percent = size_percent(img, size, &width, &height);
+
+  if (format == FMT_UNKNOWN || percent <= 0)
+    return -1;
+  if (engine_decode_at(img, &src, percent, &width, &height))
+    return -1;
+  if (finish_decode(&src, &dst, engine_scaled(width, percent), engine_scaled(height, percent)))
+    return -1;
+
+  if (format == FMT_JPEG && engine_source(img, &source) == 0) {
+    jpeg_opts_t o = {0, 0, 0, &source, 0, EXIF_ORIENTATION};
+    FILE* fp = fopen(rename, "wb");
+    ret = fp != NULL ? write_jpeg(&dst, fp, &o) : -1;
+    if (fp != NULL && fclose(fp) != 0)
+      ret = -1;
+    engine_source_free(&source);
+  }
+  else
+    ret = engine_encode(&dst, rename, format);
+  engine_free(&dst);
+  return ret;
+}
+
+/* Releases the planes of a planar image
+ *
+ * @param p the planar image
+ */
+static void planar_free(planar_t* p) {
+  int ci;
+  for (ci = 0; ci < 3; ci++)
+    engine_free(p->plane + ci);
+}
+
+/* The size of a component's plane in an image of the given
+ * size, ceil(len * samp / max_samp) as libjpeg lays it out
+ */
+static int plane_len(int len, int samp, int max_samp) {
+  return (int) (((long) len * samp + max_samp - 1) / max_samp);
+}
+
+static int max_samp(const int* samp, int ncomp) {
+  int ci, max = 1;
+  for (ci = 0; ci < ncomp; ci++)
+    if (samp[ci] > max)
+      max = samp[ci];
+  return max;
+}
+
+/* Decodes a YCbCr (or gray) jpg into its planes at their native
+ * subsampling, without upsampling the chroma or converting to rgb.
+ * Like decode_jpeg(), it scales down in the DCT domain as far as percent allows;
+ * libjpeg then decodes the chroma at up to the luma's size, so the planes
+ * can be larger than the sampling factors say until finish_decode_planar().
+ * A decode bigger than ENGINE_STREAM_PIXELS is streamed plane by plane
+ * straight to percent of the jpg's size instead.
+ *
+ * @param path the jpg to decode
+ * @param p the planar image to fill
+ * @param percent the size that will be made from the decode, 100 for full size
+ * @param width set to the jpg's full width
+ * @param height set to the jpg's full height
+ * @return -1 if the jpg is not YCbCr or gray or on error, 0 on success
+ */
+static int decode_jpeg_planar(const char* path, planar_t* p, double percent, int* width, int* height) {
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_err err;
+  stream_t s[3];
+  JSAMPROW* rows[3] = {NULL, NULL, NULL};
+  JSAMPARRAY bufs[3];
+  unsigned char* strip[3] = {NULL, NULL, NULL};
+  int padded[3], strip_rows[3];
+  int ci, y, lines, stream, mh, mv;
+  FILE* fp;
+
+  if ((fp = fopen(path, "rb")) == NULL)
+    return -1;
+
+  memset(p, 0, sizeof(*p));
+  memset(s, 0, sizeof(s));
+  cinfo.err = jpeg_std_error(&err.mgr);
+  err.mgr.error_exit = jpeg_err_exit;
+  if (setjmp(err.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    fclose(fp);
+    for (ci = 0; ci < 3; ci++) {
+      resample_stream_free(s + ci);
+      free(rows[ci]);
+      free(strip[ci]);
+    }
+    planar_free(p);
+    return -1;
+  }
+
+  jpeg_create_decompress(&cinfo);
+  jpeg_stdio_src(&cinfo, fp);
+  jpeg_read_header(&cinfo, TRUE);
+  if (!(cinfo.jpeg_color_space == JCS_YCbCr && cinfo.num_components == 3) &&
+      !(cinfo.jpeg_color_space == JCS_GRAYSCALE && cinfo.num_components == 1))
+    longjmp(err.jump, 1);
+
+  cinfo.raw_data_out = TRUE;
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = dct_denom(cinfo.image_width, cinfo.image_height, percent);
+  *width = cinfo.image_width;
+  *height = cinfo.image_height;
+  jpeg_start_decompress(&cinfo);
+
+  // a big decode goes plane by plane through the resampler as it comes out
+  stream = streams(cinfo.output_width, cinfo.output_height, engine_scaled(*width, percent), engine_scaled(*height, percent));
+  p->width = stream ? engine_scaled(*width, percent) : (int) cinfo.output_width;
+  p->height = stream ? engine_scaled(*height, percent) : (int) cinfo.output_height;
+  p->ncomp = cinfo.num_components;
+  mh = cinfo.max_h_samp_factor;
+  mv = cinfo.max_v_samp_factor;
+  for (ci = 0; ci < p->ncomp; ci++) {
+    jpeg_component_info* comp = cinfo.comp_info + ci;
+    p->h_samp[ci] = comp->h_samp_factor;
+    p->v_samp[ci] = comp->v_samp_factor;
+    if (stream) {
+      if (resample_stream_start(s + ci, comp->downsampled_width, comp->downsampled_height, 1, p->plane + ci,
+				plane_len(p->width, p->h_samp[ci], mh), plane_len(p->height, p->v_samp[ci], mv), ENGINE_FILTER))
+	longjmp(err.jump, 1);
+    }
+    else {
+      p->plane[ci].width = comp->downsampled_width;
+      p->plane[ci].height = comp->downsampled_height;
+      p->plane[ci].channels = 1;
+      p->plane[ci].pixels = (unsigned char*) malloc((size_t) comp->downsampled_width * comp->downsampled_height);
+      if (p->plane[ci].pixels == NULL)
+	longjmp(err.jump, 1);
+    }
+
+    // libjpeg hands out whole iMCU rows of whole blocks, read them into a strip
+    padded[ci] = comp->width_in_blocks * comp->DCT_scaled_size;
+    strip_rows[ci] = comp->v_samp_factor * comp->DCT_scaled_size;
+    strip[ci] = (unsigned char*) malloc((size_t) padded[ci] * strip_rows[ci]);
+    rows[ci] = (JSAMPROW*) malloc(strip_rows[ci] * sizeof(JSAMPROW));
+    if (strip[ci] == NULL || rows[ci] == NULL)
+      longjmp(err.jump, 1);
+    for (y = 0; y < strip_rows[ci]; y++)
+      rows[ci][y] = strip[ci] + (size_t) y * padded[ci];
+    bufs[ci] = rows[ci];
+  }
+
+  lines = cinfo.max_v_samp_factor * cinfo.min_DCT_scaled_size;
+  for (y = 0; cinfo.output_scanline < cinfo.output_height; y++) {
+    jpeg_read_raw_data(&cinfo, bufs, lines);
+    for (ci = 0; ci < p->ncomp; ci++) {
+      jpeg_component_info* comp = cinfo.comp_info + ci;
+      int r;
+      for (r = 0; r < strip_rows[ci] && y * strip_rows[ci] + r < (int) comp->downsampled_height; r++) {
+	if (stream)
+	  resample_stream_push(s + ci, rows[ci][r]);
+	else
+	  memcpy(p->plane[ci].pixels + (size_t) (y * strip_rows[ci] + r) * p->plane[ci].width, rows[ci][r], p->plane[ci].width);
+      }
+    }
+  }
+
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  fclose(fp);
+  for (ci = 0; ci < 3; ci++) {
+    resample_stream_free(s + ci);
+    free(rows[ci]);
+    free(strip[ci]);
+  }
+  return 0;
+}
+
+/* Writes YCbCr (or gray) planes as a jpg, keeping
+ * their subsampling, without any color conversion
+ *
+ * @param p the planar image
+ * @param fp the stream to write to
+ * @param o how to write the jpg, NULL for a baseline jpg at JPEG_QUALITY
+ * @return -1 on error, 0 on success
+ */
+static int write_jpeg_planar(const planar_t* p, FILE* fp, const jpeg_opts_t* o) {
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_err err;
+  JSAMPROW* rows[3] = {NULL, NULL, NULL};
+  JSAMPARRAY bufs[3];
+  unsigned char* strip[3] = {NULL, NULL, NULL};
+  int padded[3], strip_rows[3];
+  int ci, y, x, r, lines, ret = -1;
+
+  cinfo.err = jpeg_std_error(&err.mgr);
+  err.mgr.error_exit = jpeg_err_exit;
+  if (setjmp(err.jump)) {
+    jpeg_destroy_compress(&cinfo);
+    goto done;
+  }
+
+  jpeg_create_compress(&cinfo);
+  jpeg_stdio_dest(&cinfo, fp);
+  cinfo.image_width = p->width;
+  cinfo.image_height = p->height;
+  cinfo.input_components = p->ncomp;
+  cinfo.in_color_space = p->ncomp == 1 ? JCS_GRAYSCALE : JCS_YCbCr;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_colorspace(&cinfo, cinfo.in_color_space);
+  for (ci = 0; ci < p->ncomp; ci++) {
+    cinfo.comp_info[ci].h_samp_factor = p->h_samp[ci];
+    cinfo.comp_info[ci].v_samp_factor = p->v_samp[ci];
+  }
+  jpeg_tune(&cinfo, o);
+  cinfo.raw_data_in = TRUE;
+  jpeg_start_compress(&cinfo, TRUE);
+  keep_source(&cinfo, o);
+
+  for (ci = 0; ci < p->ncomp; ci++) {
+    jpeg_component_info* comp = cinfo.comp_info + ci;
+    padded[ci] = comp->width_in_blocks * DCTSIZE;
+    strip_rows[ci] = comp->v_samp_factor * DCTSIZE;
+    strip[ci] = (unsigned char*) malloc((size_t) padded[ci] * strip_rows[ci]);
+    rows[ci] = (JSAMPROW*) malloc(strip_rows[ci] * sizeof(JSAMPROW));
+    if (strip[ci] == NULL || rows[ci] == NULL)
+      longjmp(err.jump, 1);
+    for (r = 0; r < strip_rows[ci]; r++)
+      rows[ci][r] = strip[ci] + (size_t) r * padded[ci];
+    bufs[ci] = rows[ci];
+  }
+
+  // fill whole iMCU rows, replicating the last column and row into the padding
+  lines = cinfo.max_v_samp_factor * DCTSIZE;
+  for (y = 0; cinfo.next_scanline < cinfo.image_height; y++) {
+    for (ci = 0; ci < p->ncomp; ci++) {
+      const raster_t* plane = p->plane + ci;
+      for (r = 0; r < strip_rows[ci]; r++) {
+	int sy = y * strip_rows[ci] + r;
+	const unsigned char* in = plane->pixels + (size_t) (sy < plane->height ? sy : plane->height - 1) * plane->width;
+	memcpy(rows[ci][r], in, plane->width);
+	for (x = plane->width; x < padded[ci]; x++)
+	  rows[ci][r][x] = in[plane->width - 1];
+      }
+    }
+    jpeg_write_raw_data(&cinfo, bufs, lines);
+  }
+
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  ret = 0;
+
+ done:
+  for (ci = 0; ci < 3; ci++) {
+    free(rows[ci]);
+    free(strip[ci]);
+  }
+  return ret;
+}
+
+/* Writes a jpg from either a raster or planes
+ *
+ * @return -1 on error, 0 on success
+ */
+static int write_any(const raster_t* r, const planar_t* p, FILE* fp, const jpeg_opts_t* o) {
+  return p != NULL ? write_jpeg_planar(p, fp, o) : write_jpeg(r, fp, o);
+}
+
+/* Encodes a jpg in memory to see how big it comes out
+ *
+ * @return the size in bytes, -1 on error
+ */
+static long trial_size(const raster_t* r, const planar_t* p, const jpeg_opts_t* o) {
+  char* buf = NULL;
+  size_t len = 0;
+  FILE* fp;
+  int ret;
+
+  if ((fp = open_memstream(&buf, &len)) == NULL)
+    return -1;
+  ret = write_any(r, p, fp, o);
+  if (fclose(fp) != 0)
+    ret = -1;
+  free(buf);
+  return ret ? -1 : (long) len;
+}
+
+/* Finds the highest quality, up to o->quality, at which a jpg fits
+ * o->budget bytes. Each round encodes ENGINE_TRIALS qualities spread over
+ * what is left of the range, in memory, each in a child process, so the
+ * trials run side by side; the range then narrows to between the best
+ * quality that fit and the worst that didn't. 100 qualities take 3 rounds.
+ *
+ * @param r the raster, or NULL for planes
+ * @param p the planes, or NULL for a raster
+ * @param o how to write the jpg, with a budget
+ * @return the quality, 0 if not even 1 fits
+ */
+static int fit_quality(const raster_t* r, const planar_t* p, const jpeg_opts_t* o) {
+  int lo = 1, hi = opts_quality(o);  // lo fits (or is as low as it goes), nothing above hi does
+  int fit = 0;                       // 1 once a trial has fit, and so lo is known to
+  jpeg_opts_t lowest = *o;
+
+  while (lo < hi) {
+    int q[ENGINE_TRIALS], fds[ENGINE_TRIALS], n = 0, i;
+    pid_t pids[ENGINE_TRIALS];
+
+    for (i = 0; i < ENGINE_TRIALS; i++) {
+      int pipefd[2], next = lo + (int) ((long) (hi - lo) * (i + 1) / ENGINE_TRIALS);
+      if (n > 0 && next == q[n - 1])
+	continue;
+      if (pipe(pipefd) != 0)
+	break;
+      if ((pids[n] = fork()) == 0) {
+	jpeg_opts_t trial = *o;
+	long size;
+	trial.quality = next;
+	size = trial_size(r, p, &trial);
+	close(pipefd[0]);
+	_exit(write(pipefd[1], &size, sizeof(size)) == sizeof(size) ? 0 : 1);
+      }
+      close(pipefd[1]);
+      if (pids[n] < 0) {
+	close(pipefd[0]);
+	break;
+      }
+      q[n] = next;
+      fds[n++] = pipefd[0];
+    }
+    if (n == 0)
+      break;  // no trials could be started: settle for what is known to fit
+
+    // sizes grow with quality: the last trial that fits is the new floor,
+    // and the first that doesn't, less one, the new ceiling
+    for (i = 0; i < n; i++) {
+      long size = -1;
+      int status;
+      if (read(fds[i], &size, sizeof(size)) != sizeof(size))
+	size = -1;
+      close(fds[i]);
+      waitpid(pids[i], &status, 0);
+      if (size >= 0 && size <= o->budget) {
+	fit = 1;
+	if (q[i] > lo)
+	  lo = q[i];
+      }
+      else if (q[i] - 1 < hi)
+	hi = q[i] - 1;
+    }
+    if (hi < lo)
+      hi = lo;
+  }
+
+  // no trial has fit, so lo is still 1, which no trial has tried
+  lowest.quality = 1;
+  if (!fit) {
+    long size = trial_size(r, p, &lowest);
+    if (size < 0 || size > o->budget)
+      return 0;
+  }
+  return lo;
+}
+
+/* Encodes a jpg from either a raster or planes to a file, at the
+ * highest quality that fits the budget if there is one
+ *
+ * @param r the raster, or NULL for planes
+ * @param p the planes, or NULL for a raster
+ * @param path the file to write
+ * @param o how to write the jpg, NULL for a baseline jpg at JPEG_QUALITY
+ * @return -1 on error, 0 on success
+ */
+static int encode_jpeg(const raster_t* r, const planar_t* p, const char* path, const jpeg_opts_t* o) {
+  jpeg_opts_t fitted;
+  FILE* fp;
+  int ret;
+
+  if (o != NULL && o->budget > 0) {
+    fitted = *o;
+    fitted.quality = fit_quality(r, p, o);
+    fitted.budget = 0;
+    if (fitted.quality == 0) {
+      // still write it, at the least it can be, so the album has the photo
+      fprintf(stderr, "Error: %s doesn't fit in %ld bytes even at quality 1\n", path, o->budget);
+      fitted.quality = 1;
+    }
+    o = &fitted;
+  }
+  if ((fp = fopen(path, "wb")) == NULL)
+    return -1;
+  ret = write_any(r, p, fp, o);
+  if (fclose(fp) != 0)
+    ret = -1;
+  return ret;
+}
+
+/* Resamples every plane of a planar image, each at its own
+ * subsampling, so the chroma is never upsampled
+ *
+ * @param src the source planes
+ * @param dst the planes to fill, released with planar_free()
+ * @param width the destination (luma) width
+ * @param height the destination (luma) height
+ * @return -1 on error, 0 on success
+ */
+static int planar_resample(const planar_t* src, planar_t* dst, int width, int height) {
+  int mh = max_samp(src->h_samp, src->ncomp), mv = max_samp(src->v_samp, src->ncomp);
+  int ci;
+
+  *dst = *src;
+  dst->width = width;
+  dst->height = height;
+  for (ci = 0; ci < src->ncomp; ci++)
+    dst->plane[ci].pixels = NULL;
+  for (ci = 0; ci < src->ncomp; ci++) {
+    if (engine_resample(src->plane + ci, dst->plane + ci,
+			plane_len(width, src->h_samp[ci], mh), plane_len(height, src->v_samp[ci], mv))) {
+      planar_free(dst);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Rotates every plane of a planar image by 90 degrees,
+ * swapping the horizontal and vertical sampling factors
+ *
+ * @param p the planar image
+ * @param rot_dir 1 for clockwise, 2 for counter-clockwise
+ * @return -1 on error, 0 on success
+ */
+static int planar_rotate(planar_t* p, int rot_dir) {
+  int ci, t;
+  for (ci = 0; ci < p->ncomp; ci++) {
+    if (engine_rotate_raster(p->plane + ci, rot_dir))
+      return -1;
+    t = p->h_samp[ci];
+    p->h_samp[ci] = p->v_samp[ci];
+    p->v_samp[ci] = t;
+  }
+  t = p->width;
+  p->width = p->height;
+  p->height = t;
+  return 0;
+}
+
+/* Brings a planar decode to the target size, see finish_decode()
+ *
+ * @param src the decoded planes, taken over (freed or moved into dst)
+ * @param dst the planes to fill, released with planar_free()
+ * @param width the target (luma) width
+ * @param height the target (luma) height
+ * @return -1 on error, 0 on success
+ */
+static int finish_decode_planar(planar_t* src, planar_t* dst, int width, int height) {
+  int mh = max_samp(src->h_samp, src->ncomp), mv = max_samp(src->v_samp, src->ncomp);
+  int ci, ret = 0, same = src->width == width && src->height == height;
+
+  // a scaled decode may come out with its chroma upsampled by the IDCT
+  for (ci = 0; ci < src->ncomp; ci++)
+    if (src->plane[ci].width != plane_len(width, src->h_samp[ci], mh) ||
+	src->plane[ci].height != plane_len(height, src->v_samp[ci], mv))
+      same = 0;
+  if (same) {
+    *dst = *src;
+    memset(src, 0, sizeof(*src));
+  }
+  else
+    ret = planar_resample(src, dst, width, height);
+  planar_free(src);
+  return ret;
+}
+
+/* Fans one decode of an image out to a large and a small output,
+ * and, with widths, to a responsive image set, see engine_pyramid().
+ * The source is decoded once, at (about) the large size or the widest
+ * width it is wider than, whichever is bigger; the large output is
+ * resampled from it, and the small output from the large one rather
+ * than from the full-size source. A small size that comes out bigger,
+ * e.g. a 320x240 box on a photo whose large size is 10% of it, is made
+ * first instead, and the large output from it. Nothing is written; the
+ * caller encodes them with engine_fanout_encode() when it is ready to.
+ *
+ * A YCbCr (or gray) jpg stays in its planes end to end, at their
+ * native subsampling: no YCbCr -> rgb -> YCbCr round trip, and the
+ * chroma is never upsampled only to be subsampled again.
+ *
+ * @param img the image to resize
+ * @param small_size the small size, see engine_percent()
+ * @param large_size the large size
+ * @param widths the widths engine_pyramid() will make, widest first
+ * @param n the number of widths, at most PYRAMID_MAX, 0 for none
+ * @param f the fanout to fill, released with engine_fanout_free()
+ * @return -1 if the engine can't handle img (caller should
+ *         fall back on magick), 0 on success
+ */
+int engine_fanout(char* img, char* small_size, char* large_size, const int widths[], int n, fanout_t* f) {
+  int width = 0, height = 0, top, ret;
+  double small_pct, large_pct, wide_pct, narrow_pct, decode_pct;
+  raster_t *wide, *narrow;
+  planar_t *wide_ycc, *narrow_ycc;
+
+  memset(f, 0, sizeof(*f));
+  f->format = engine_format(img);
+  if (f->format == FMT_UNKNOWN || n < 0 || n > PYRAMID_MAX || engine_source(img, &f->source))
+    return -1;
+  small_pct = n > 0 && engine_probe(img, &width, &height) ? -1 : size_percent(img, small_size, &width, &height);
+  large_pct = size_percent(img, large_size, &width, &height);
+  if (small_pct <= 0 || large_pct <= 0) {
+    engine_fanout_free(f);
+    return -1;
+  }
+  // the wider output is resampled from the decode, the narrower from it
+  wide_pct = large_pct >= small_pct ? large_pct : small_pct;
+  narrow_pct = large_pct >= small_pct ? small_pct : large_pct;
+  wide = large_pct >= small_pct ? &f->large : &f->small;
+  narrow = large_pct >= small_pct ? &f->small : &f->large;
+  wide_ycc = large_pct >= small_pct ? &f->large_ycc : &f->small_ycc;
+  narrow_ycc = large_pct >= small_pct ? &f->small_ycc : &f->large_ycc;
+
+  // widths as wide as the source or wider are skipped, the rest need the decode held
+  for (top = 0; top < n && widths[top] >= width; top++)
+    ;
+  f->n = n;
+  memcpy(f->widths, widths, n * sizeof(int));
+  decode_pct = wide_pct;
+  if (top < n && 100.0 * widths[top] / width > decode_pct)
+    decode_pct = 100.0 * widths[top] / width;
+
+  // a jpg is decoded straight at (about) that size
+  if (f->format == FMT_JPEG && decode_jpeg_planar(img, &f->src_ycc, decode_pct, &width, &height) == 0) {
+    f->planar = 1;
+    f->width = width;
+    f->height = height;
+    ret = top < n ?
+      planar_resample(&f->src_ycc, wide_ycc, engine_scaled(width, wide_pct), engine_scaled(height, wide_pct)) :
+      finish_decode_planar(&f->src_ycc, wide_ycc, engine_scaled(width, wide_pct), engine_scaled(height, wide_pct));
+    if (ret || planar_resample(wide_ycc, narrow_ycc, engine_scaled(width, narrow_pct), engine_scaled(height, narrow_pct))) {
+      engine_fanout_free(f);
+      return -1;
+    }
+    return 0;
+  }
+
+  if (engine_decode_at(img, &f->src, decode_pct, &width, &height)) {
+    engine_fanout_free(f);
+    return -1;
+  }
+  f->width = width;
+  f->height = height;
+  ret = top < n ?
+    engine_resample(&f->src, wide, engine_scaled(width, wide_pct), engine_scaled(height, wide_pct)) :
+    finish_decode(&f->src, wide, engine_scaled(width, wide_pct), engine_scaled(height, wide_pct));
+  if (ret || engine_resample(wide, narrow, engine_scaled(width, narrow_pct), engine_scaled(height, narrow_pct))) {
+    engine_fanout_free(f);
+    return -1;
+  }
+  return 0;
+}
+
+/* Encodes one output of a fanout, in the format of its source
+ *
+ * @param f the fanout
+ * @param large 1 for the large output, 0 for the small one
+ * @param path the file to write
+ * @param o how to write it if it is a jpg, NULL for a baseline jpg;
+ *        either way it keeps the source's quality unless o gives one, and
+ *        the EXIF o->exif asks for
+ * @return -1 on error, 0 on success
+ */
+int engine_fanout_encode(const fanout_t* f, int large, const char* path, const jpeg_opts_t* o) {
+  jpeg_opts_t with_source = {0, 0, 0, NULL, 0, EXIF_ORIENTATION};
+
+  if (o != NULL)
+    with_source = *o;
+  with_source.source = &f->source;
+  if (f->planar)
+    return encode_jpeg(NULL, large ? &f->large_ycc : &f->small_ycc, path, &with_source);
+  if (f->format == FMT_JPEG)
+    return encode_jpeg(large ? &f->large : &f->small, NULL, path, &with_source);
+  return engine_encode(large ? &f->large : &f->small, path, f->format);
+}
+
+/* Rotates both outputs of a fanout by 90 degrees
+ *
+ * @param f the fanout
+ * @param rot_dir 1 for clockwise, 2 for counter-clockwise
+ * @return -1 on error, 0 on success
+ */
+int engine_fanout_rotate(fanout_t* f, int rot_dir) {
+  if (f->planar)
+    return planar_rotate(&f->small_ycc, rot_dir) || planar_rotate(&f->large_ycc, rot_dir) ? -1 : 0;
+  return engine_rotate_raster(&f->small, rot_dir) || engine_rotate_raster(&f->large, rot_dir) ? -1 : 0;
+}
+
+/* Releases both outputs of a fanout
+ *
+ * @param f the fanout
+ */
+void engine_fanout_free(fanout_t* f) {
+  engine_free(&f->small);
+  engine_free(&f->large);
+  engine_free(&f->src);
+  planar_free(&f->small_ycc);
+  planar_free(&f->large_ycc);
+  planar_free(&f->src_ycc);
+  engine_source_free(&f->source);
+}
+
+/* Builds a responsive image set: an image at the widths given to
+ * engine_fanout(), as a cascade from the decode the fanout held on to.
+ * The widest level is resampled from that decode, which is then
+ * released, and every other level from the one above it rather than
+ * from the full-size source. Widths as wide as the source or wider
+ * are skipped: there is nothing to gain from upscaling.
+ * A jpg fanout in planes gives levels in planes.
+ *
+ * @param f the fanout, whose decode is used up
+ * @param p the set to fill, released with engine_pyramid_free();
+ *        level i is left empty for a width that was skipped, see engine_pyramid_has()
+ * @return -1 on error, 0 on success
+ */
+int engine_pyramid(fanout_t* f, pyramid_t* p) {
+  int i, ret, prev = -1;
+
+  memset(p, 0, sizeof(*p));
+  p->format = f->format;
+  p->planar = f->planar;
+  p->source = &f->source;
+  p->n = f->n;
+  for (i = 0; i < f->n; i++) {
+    double percent = 100.0 * f->widths[i] / f->width;
+    int width = engine_scaled(f->width, percent), height = engine_scaled(f->height, percent);
+    if (f->widths[i] >= f->width)
+      continue;
+    if (f->planar)
+      ret = prev < 0 ?
+	finish_decode_planar(&f->src_ycc, &p->level_ycc[i], width, height) :
+	planar_resample(&p->level_ycc[prev], &p->level_ycc[i], width, height);
+    else
+      ret = prev < 0 ?
+	finish_decode(&f->src, &p->level[i], width, height) :
+	engine_resample(&p->level[prev], &p->level[i], width, height);
+    if (ret) {
+      engine_pyramid_free(p);
+      return -1;
+    }
+    prev = i;
+  }
+  return 0;
+}
+
+/* Tells whether a level of a responsive image set was made
+ *
+ * @param p the set
+ * @param i the level
+ * @return 1 if it was, 0 if its width was skipped
+ */
+int engine_pyramid_has(const pyramid_t* p, int i) {
+  if (i < 0 || i >= p->n)
+    return 0;
+  return (p->planar ? p->level_ycc[i].plane[0].pixels : p->level[i].pixels) != NULL;
+}
+
+/* Encodes one level of a responsive image set, in the format of its source
+ *
+ * @param p the set
+ * @param i the level
+ * @param path the file to write
+ * @param o how to write it if it is a jpg, NULL for a baseline jpg;
+ *        either way it keeps the source's quality unless o gives one, and
+ *        the EXIF o->exif asks for
+ * @return -1 on error, 0 on success
+ */
+int engine_pyramid_encode(const pyramid_t* p, int i, const char* path, const jpeg_opts_t* o) {
+  jpeg_opts_t with_source = {0, 0, 0, NULL, 0, EXIF_ORIENTATION};
+
+  if (!engine_pyramid_has(p, i))
+    return -1;
+  if (o != NULL)
+    with_source = *o;
+  with_source.source = p->source;
+  if (p->planar)
+    return encode_jpeg(NULL, &p->level_ycc[i], path, &with_source);
+  if (p->format == FMT_JPEG)
+    return encode_jpeg(&p->level[i], NULL, path, &with_source);
+  return engine_encode(&p->level[i], path, p->format);
+}
+
+/* Rotates every level of a responsive image set by 90 degrees
+ *
+ * @param p the set
+ * @param rot_dir 1 for clockwise, 2 for counter-clockwise
+ * @return -1 on error, 0 on success
+ */
+int engine_pyramid_rotate(pyramid_t* p, int rot_dir) {
+  int i;
+  for (i = 0; i < p->n; i++) {
+    if (!engine_pyramid_has(p, i))
+      continue;
+    if (p->planar ? planar_rotate(&p->level_ycc[i], rot_dir) : engine_rotate_raster(&p->level[i], rot_dir))
+      return -1;
+  }
+  return 0;
+}
+
+/* Releases every level of a responsive image set
+ *
+ * @param p the set
+ */
+void engine_pyramid_free(pyramid_t* p) {
+  int i;
+  for (i = 0; i < p->n; i++) {
+    engine_free(&p->level[i]);
+    planar_free(&p->level_ycc[i]);
+  }
+}
+
+/* Rotates a raster in place by 90 degrees
+ *
+ * @param r the raster to rotate
+ * @param rot_dir 1 for clockwise, 2 for counter-clockwise
+ * @return -1 on error, 0 on success
+ */
+int engine_rotate_raster(raster_t* r, int rot_dir) {
+  int c = r->channels;
+  int x, y, k;
+  unsigned char* rotated;
+
+  if (rot_dir != 1 && rot_dir != 2)
+    return -1;
+  if ((rotated = (unsigned char*) malloc((size_t) r->width * r->height * c)) == NULL)
+    return -1;
+
+  // rotated is height wide and width tall
+  for (y = 0; y < r->height; y++) {
+    const unsigned char* in = r->pixels + (size_t) y * r->width * c;
+    for (x = 0; x < r->width; x++) {
+      // clockwise: (x, y) -> (height-1-y, x); counter-clockwise: (x, y) -> (y, width-1-x)
+      int rx = rot_dir == 1 ? r->height - 1 - y : y;
+      int ry = rot_dir == 1 ? x : r->width - 1 - x;
+      unsigned char* out = rotated + ((size_t) ry * r->height + rx) * c;
+      for (k = 0; k < c; k++)
+	out[k] = in[x * c + k];
+    }
+  }
+
+  free(r->pixels);
+  r->pixels = rotated;
+  x = r->width;
+  r->width = r->height;
+  r->height = x;
+  return 0;
+}
+
+/* Rotates one 8x8 block of DCT coefficients by 90 degrees.
+ * A clockwise turn is a transpose followed by a horizontal mirror,
+ * which negates the odd horizontal frequencies; counter-clockwise is
+ * a transpose followed by a vertical mirror (odd vertical frequencies).
+ *
+ * @param src the source block
+ * @param dst the block to fill
+ * @param clockwise 1 for clockwise, 0 for counter-clockwise
+ */
+static void rotate_block(JCOEFPTR src, JCOEFPTR dst, int clockwise) {
+  int u, v;
+  for (v = 0; v < DCTSIZE; v++) {
+    for (u = 0; u < DCTSIZE; u++) {
+      JCOEF c = src[u * DCTSIZE + v];
+      dst[v * DCTSIZE + u] = ((clockwise ? u : v) & 1) ? -c : c;
+    }
+  }
+}
+
+/* Rotates a jpg by 90 degrees without decoding it, the way jpegtran
+ * does: the quantized DCT coefficient blocks are moved and transposed,
+ * so there is no second round of quality loss. The edge that turns into
+ * the left (clockwise) or top (counter-clockwise) edge must be a whole
+ * number of MCUs, otherwise its partial blocks would land inside the image.
+ *
+ * dest may be the same file as img; the result is written to a
+ * temporary file first and renamed over dest.
+ *
+ * @param img the jpg to rotate
+ * @param dest the file to write the rotated jpg to
+ * @param rot_dir 1 for clockwise, 2 for counter-clockwise
+ * @return -1 if img is not a jpg, not MCU-aligned, or on error
+ *         (caller should fall back on magick), 0 on success
+ */
+int engine_rotate(char* img, char* dest, int rot_dir) {
+  struct jpeg_decompress_struct src;
+  struct jpeg_compress_struct dst;
+  struct jpeg_err err;
+  jvirt_barray_ptr* src_coef;
+  jvirt_barray_ptr dst_coef[MAX_COMPONENTS];
+  jpeg_saved_marker_ptr marker;
+  FILE* in = NULL;
+  FILE* volatile out = NULL;  // set after setjmp(), read in its error branch
+  char* tmp = NULL;
+  int clockwise = rot_dir == 1;
+  int ci, i, bx, by;
+
+  if ((rot_dir != 1 && rot_dir != 2) || engine_format(img) != FMT_JPEG)
+    return -1;
+  if ((in = fopen(img, "rb")) == NULL)
+    return -1;
+  if ((tmp = (char*) malloc(strlen(dest) + strlen(".tmp") + 1)) == NULL) {
+    fclose(in);
+    return -1;
+  }
+  sprintf(tmp, "%s.tmp", dest);
+
+  src.err = dst.err = jpeg_std_error(&err.mgr);
+  err.mgr.error_exit = jpeg_err_exit;
+  jpeg_create_decompress(&src);
+  jpeg_create_compress(&dst);
+  if (setjmp(err.jump)) {
+    jpeg_destroy_compress(&dst);
+    jpeg_destroy_decompress(&src);
+    fclose(in);
+    if (out != NULL) {
+      fclose(out);
+      remove(tmp);
+    }
+    free(tmp);
+    return -1;
+  }
+
+  jpeg_stdio_src(&src, in);
+  // keep exif, icc & comments; jpeg_write_coefficients() writes its own JFIF APP0
+  for (i = 1; i < 16; i++)
+    jpeg_save_markers(&src, JPEG_APP0 + i, 0xffff);
+  jpeg_save_markers(&src, JPEG_COM, 0xffff);
+  jpeg_read_header(&src, TRUE);
+
+  // the mirrored edge has to be MCU-aligned to be moved losslessly
+  if (clockwise ? src.image_height % (src.max_v_samp_factor * DCTSIZE) != 0
+                : src.image_width % (src.max_h_samp_factor * DCTSIZE) != 0)
+    longjmp(err.jump, 1);
+
+  // request the rotated arrays before jpeg_read_coefficients() realizes them;
+  // a component's block grid turns from bw x bh into bh x bw
+  for (ci = 0; ci < src.num_components; ci++) {
+    jpeg_component_info* comp = src.comp_info + ci;
+    int bw = comp->height_in_blocks, bh = comp->width_in_blocks;
+    int h = comp->v_samp_factor, v = comp->h_samp_factor;
+    dst_coef[ci] = (*src.mem->request_virt_barray)
+      ((j_common_ptr) &src, JPOOL_IMAGE, TRUE, (bw + h - 1) / h * h, (bh + v - 1) / v * v, v);
+  }
+  src_coef = jpeg_read_coefficients(&src);
+
+  for (ci = 0; ci < src.num_components; ci++) {
+    jpeg_component_info* comp = src.comp_info + ci;
+    int bw = comp->height_in_blocks, bh = comp->width_in_blocks;
+    for (by = 0; by < bh; by++) {
+      JBLOCKARRAY dst_row = (*src.mem->access_virt_barray)
+	((j_common_ptr) &src, dst_coef[ci], by, 1, TRUE);
+      for (bx = 0; bx < bw; bx++) {
+	// clockwise: dst (bx, by) <- src (by, bw-1-bx)
+	// counter-clockwise: dst (bx, by) <- src (bh-1-by, bx)
+	int sx = clockwise ? by : bh - 1 - by;
+	int sy = clockwise ? bw - 1 - bx : bx;
+	JBLOCKARRAY src_row = (*src.mem->access_virt_barray)
+	  ((j_common_ptr) &src, src_coef[ci], sy, 1, FALSE);
+	rotate_block(src_row[0][sx], dst_row[0][bx], clockwise);
+      }
+    }
+  }
+
+  // same tables and sampling as the source, with both transposed
+  jpeg_copy_critical_parameters(&src, &dst);
+  dst.image_width = src.image_height;
+  dst.image_height = src.image_width;
+  for (ci = 0; ci < dst.num_components; ci++) {
+    int h = dst.comp_info[ci].h_samp_factor;
+    dst.comp_info[ci].h_samp_factor = dst.comp_info[ci].v_samp_factor;
+    dst.comp_info[ci].v_samp_factor = h;
+  }
+  for (i = 0; i < NUM_QUANT_TBLS; i++) {
+    JQUANT_TBL* q = dst.quant_tbl_ptrs[i];
+    int u, v;
+    for (v = 0; q != NULL && v < DCTSIZE; v++) {
+      for (u = v + 1; u < DCTSIZE; u++) {
+	UINT16 t = q->quantval[v * DCTSIZE + u];
+	q->quantval[v * DCTSIZE + u] = q->quantval[u * DCTSIZE + v];
+	q->quantval[u * DCTSIZE + v] = t;
+      }
+    }
+  }
+
+  if ((out = fopen(tmp, "wb")) == NULL)
+    longjmp(err.jump, 1);
+  jpeg_stdio_dest(&dst, out);
+  jpeg_write_coefficients(&dst, dst_coef);
+  for (marker = src.marker_list; marker != NULL; marker = marker->next)
+    jpeg_write_marker(&dst, marker->marker, marker->data, marker->data_length);
+  jpeg_finish_compress(&dst);
+  jpeg_finish_decompress(&src);
+  jpeg_destroy_compress(&dst);
+  jpeg_destroy_decompress(&src);
+  fclose(in);
+  fclose(out);
+
+  if (rename(tmp, dest) != 0) {
+    remove(tmp);
+    free(tmp);
+    return -1;
+  }
+  free(tmp);
+  return 0;
+}
@@ -0,0 +1,112 @@
+/* engine.h
+ * 15 October 2026
+ * header file for engine.c, the in-process decode -> resample -> encode engine
+ */
+
+#ifndef __ENGINE_H
+#define __ENGINE_H
+
+#define FMT_UNKNOWN 0
+#define FMT_JPEG    1
+#define FMT_PNG     2
+
+#define JPEG_QUALITY 92  // ImageMagick's default when the source quality is unknown
+#define ENGINE_FILTER 1  // FILTER_TRIANGLE, see resample.h
+#define ENGINE_TRIALS 4  // trial encodes run side by side when fitting a jpg to a budget
+#define PYRAMID_MAX 8  // most levels in a responsive image set
+#define ENGINE_STREAM_PIXELS (16L * 1000 * 1000)  // decodes bigger than this are streamed into the resampler
+
+/* An interleaved 8-bit image held in memory.
+ * channels is 1 (gray), 3 (rgb) or 4 (rgba)
+ */
+typedef struct raster {
+  int width;
+  int height;
+  int channels;
+  unsigned char* pixels;  // width * height * channels bytes, row-major
+} raster_t;
+
+/* A YCbCr (or gray) image as separate planes, each at
+ * its own subsampling, the way a jpg stores it
+ */
+typedef struct planar {
+  int width;            // luma dimensions
+  int height;
+  int ncomp;            // 3 (YCbCr) or 1 (gray)
+  int h_samp[3];        // jpg sampling factors, per component
+  int v_samp[3];
+  raster_t plane[3];    // 1-channel planes
+} planar_t;
+
+/* What a jpg output keeps of its jpg source, see engine_source() */
+typedef struct source {
+  int quality;            // the source's estimated quality, JPEG_QUALITY if unknown
+  unsigned char* app1;    // the source's EXIF segment, without marker and length, NULL if none;
+                          // outputs only get what exif_trim() keeps of it
+  unsigned int app1_len;
+} source_t;
+
+/* One image at several widths, see engine_pyramid() */
+typedef struct pyramid {
+  int format;                   // the format of the source, and so of the levels
+  int n;                        // the widths asked for
+  int planar;                   // 1 if the levels are level_ycc, 0 if rasters
+  raster_t level[PYRAMID_MAX];  // widest first, empty for a width that was skipped
+  planar_t level_ycc[PYRAMID_MAX];
+  const source_t* source;       // the fanout's, which must outlive the set
+} pyramid_t;
+
+/* How a jpg is written */
+typedef struct jpeg_opts {
+  int quality;      // 1 to 100, 0 for the source's (JPEG_QUALITY without one)
+  int progressive;  // 1 for progressive scans with optimized Huffman tables, 0 for baseline
+  long budget;      // bytes the jpg may take, 0 for no limit: quality is then the most that fits
+  const source_t* source;  // the source whose quality and EXIF to keep, NULL for none
+  int orientation;  // EXIF Orientation to tag it with, 0 for the source's
+  int exif;         // what of the source's EXIF to keep, EXIF_ORIENTATION or EXIF_CAMERA
+} jpeg_opts_t;
+
+/* Both outputs of one decode, see engine_fanout() */
+typedef struct fanout {
+  int format;           // the format of the source, and so of the outputs
+  int planar;           // 1 if the outputs are the *_ycc planes, 0 if rasters
+  raster_t small;       // resampled from large
+  raster_t large;       // resampled from the source
+  planar_t small_ycc;
+  planar_t large_ycc;
+  raster_t src;         // the decode, held for engine_pyramid() while there are widths to make
+  planar_t src_ycc;
+  int width;            // the source's full size
+  int height;
+  int n;                // the widths to make, widest first
+  int widths[PYRAMID_MAX];
+  source_t source;      // what a jpg source's outputs keep of it
+} fanout_t;
+
+int engine_format(const char* path);
+int engine_probe(const char* path, int* width, int* height);
+int engine_source(const char* path, source_t* s);
+void engine_source_free(source_t* s);
+int engine_decode(const char* path, raster_t* r);
+int engine_decode_at(const char* path, raster_t* r, double percent, int* width, int* height);
+int engine_resample(const raster_t* src, raster_t* dst, int width, int height);
+int engine_encode(const raster_t* r, const char* path, int format);
+int engine_encode_mem(const raster_t* r, int quality, unsigned char** out, unsigned long* len);
+void engine_free(raster_t* r);
+
+int engine_scaled(int len, double percent);
+double engine_percent(const char* size, int width, int height);
+int engine_resize(char* img, char* rename, char* size);
+int engine_fanout(char* img, char* small_size, char* large_size, const int widths[], int n, fanout_t* f);
+int engine_fanout_encode(const fanout_t* f, int large, const char* path, const jpeg_opts_t* o);
+int engine_fanout_rotate(fanout_t* f, int rot_dir);
+void engine_fanout_free(fanout_t* f);
+int engine_pyramid(fanout_t* f, pyramid_t* p);
+int engine_pyramid_has(const pyramid_t* p, int i);
+int engine_pyramid_encode(const pyramid_t* p, int i, const char* path, const jpeg_opts_t* o);
+int engine_pyramid_rotate(pyramid_t* p, int rot_dir);
+void engine_pyramid_free(pyramid_t* p);
+int engine_rotate_raster(raster_t* r, int rot_dir);
+int engine_rotate(char* img, char* dest, int rot_dir);
+
+#endif // __ENGINE_H
@@ -0,0 +1,434 @@
+/* exif.c
+ * 15 October 2026
+ * Reads and edits the EXIF APP1 segment of a jpg without touching
+ * its pixels, e.g. so a photo can be rotated by its Orientation tag.
+ * https://www.cipa.jp/std/documents/e/DC-X008-Translation-2019-E.pdf
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "exif.h"
+
+#define TAG_MAKE 0x010f
+#define TAG_MODEL 0x0110
+#define TAG_ORIENTATION 0x0112
+#define TAG_DATETIME 0x0132
+#define TAG_ARTIST 0x013b
+#define TAG_COPYRIGHT 0x8298
+#define TAG_THUMB_OFFSET 0x0201  // JPEGInterchangeFormat
+#define TAG_THUMB_LENGTH 0x0202  // JPEGInterchangeFormatLength
+#define TYPE_ASCII 2
+#define TYPE_SHORT 3
+#define TYPE_LONG 4
+#define KEPT_MAX 128  // the longest tag value exif_trim() keeps
+
+/* Reads a 16 or 32-bit TIFF value in the byte order of the segment
+ *
+ * @param p the bytes
+ * @param motorola 1 for big-endian ("MM"), 0 for little-endian ("II")
+ * @return the value
+ */
+static unsigned get16(const unsigned char* p, int motorola) {
+  return motorola ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static unsigned long get32(const unsigned char* p, int motorola) {
+  return motorola
+    ? ((unsigned long) p[0] << 24) | ((unsigned long) p[1] << 16) | (p[2] << 8) | p[3]
+    : ((unsigned long) p[3] << 24) | ((unsigned long) p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+/* Walks the markers of a jpg up to the first scan, looking
+ * for an APP1 segment that carries EXIF data
+ *
+ * @param fp the open jpg
+ * @param insert_at set to where a new APP1 would go: after SOI, or after a leading JFIF APP0
+ * @param len set to the length of the EXIF payload, "Exif\0\0" included
+ * @return the file offset of the EXIF payload, 0 if there is none, -1 if fp is not a jpg
+ */
+static long find_exif(FILE* fp, long* insert_at, long* len) {
+  unsigned char m[4];
+  unsigned char id[6];
+  long pos;
+
+  rewind(fp);
+  if (fread(m, 2, 1, fp) != 1 || m[0] != 0xff || m[1] != 0xd8)
+    return -1;
+  *insert_at = 2;
+
+  while (fread(m, 4, 1, fp) == 1 && m[0] == 0xff) {
+    long seg = (m[2] << 8) | m[3];  // segment length, counting its own 2 bytes
+    pos = ftell(fp);
+    if (m[1] == 0xda || m[1] == 0xd9 || seg < 2)
+      break; // start of scan or end of image: no more headers
+
+    if (m[1] == 0xe0 && *insert_at == pos - 4)
+      *insert_at = pos - 2 + seg;  // keep JFIF first
+    if (m[1] == 0xe1 && seg >= 2 + 6 && fread(id, 6, 1, fp) == 1 && memcmp(id, "Exif\0\0", 6) == 0) {
+      *len = seg - 2;
+      return pos;
+    }
+    if (fseek(fp, pos + seg - 2, SEEK_SET) != 0)
+      break;
+  }
+  return 0;
+}
+
+/* Finds the Orientation entry in the IFD0 of an EXIF payload
+ *
+ * @param exif the payload, starting with "Exif\0\0"
+ * @param len the payload length
+ * @param motorola set to the byte order of the payload
+ * @return the offset of the entry's value within exif, -1 if not present
+ */
+static long find_orientation(const unsigned char* exif, long len, int* motorola) {
+  const unsigned char* tiff = exif + 6;
+  long tlen = len - 6;
+  unsigned long ifd;
+  unsigned i, count;
+
+  if (tlen < 8)
+    return -1;
+  if (memcmp(tiff, "MM", 2) == 0)
+    *motorola = 1;
+  else if (memcmp(tiff, "II", 2) == 0)
+    *motorola = 0;
+  else
+    return -1;
+
+  ifd = get32(tiff + 4, *motorola);
+  if (ifd + 2 > (unsigned long) tlen)
+    return -1;
+  count = get16(tiff + ifd, *motorola);
+  for (i = 0; i < count && ifd + 2 + (i + 1) * 12 <= (unsigned long) tlen; i++) {
+    const unsigned char* entry = tiff + ifd + 2 + i * 12;
+    if (get16(entry, *motorola) == TAG_ORIENTATION && get16(entry + 2, *motorola) == TYPE_SHORT)
+      return 6 + ifd + 2 + i * 12 + 8;
+  }
+  return -1;
+}
+
+/* Inserts a minimal APP1 segment holding just an Orientation
+ * tag into a jpg. The file has to be rewritten since it grows,
+ * but the entropy-coded data is copied through untouched.
+ *
+ * @param path the jpg
+ * @param fp the jpg, open for reading
+ * @param at the file offset to insert the segment at
+ * @param orientation the Orientation value
+ * @return -1 on error, 0 on success
+ */
+static int insert_exif(char* path, FILE* fp, long at, int orientation) {
+  unsigned char app1[] = {
+    0xff, 0xe1, 0x00, 0x22,                 // APP1, 34 bytes
+    'E', 'x', 'i', 'f', 0x00, 0x00,
+    'M', 'M', 0x00, 0x2a, 0x00, 0x00, 0x00, 0x08,  // big-endian TIFF header, IFD0 at 8
+    0x00, 0x01,                             // 1 entry
+    0x01, 0x12, 0x00, TYPE_SHORT, 0x00, 0x00, 0x00, 0x01, 0x00, (unsigned char) orientation, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00                  // no IFD1
+  };
+  unsigned char* data;
+  char* tmp;
+  FILE* out;
+  long size;
+  int ret = -1;
+
+  if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < at)
+    return -1;
+  if ((data = (unsigned char*) malloc(size)) == NULL)
+    return -1;
+  rewind(fp);
+  if (fread(data, size, 1, fp) != 1 || (tmp = (char*) malloc(strlen(path) + strlen(".tmp") + 1)) == NULL) {
+    free(data);
+    return -1;
+  }
+
+  sprintf(tmp, "%s.tmp", path);
+  if ((out = fopen(tmp, "wb")) != NULL) {
+    if (fwrite(data, at, 1, out) == 1 && fwrite(app1, sizeof(app1), 1, out) == 1
+	&& fwrite(data + at, size - at, 1, out) == 1)
+      ret = 0;
+    if (fclose(out) != 0)
+      ret = -1;
+    if (ret == 0 && rename(tmp, path) != 0)
+      ret = -1;
+    if (ret)
+      remove(tmp);
+  }
+
+  free(tmp);
+  free(data);
+  return ret;
+}
+
+/* Sets the EXIF Orientation tag of a jpg. An existing tag is
+ * overwritten in place; a jpg with no EXIF gets a new APP1 segment.
+ * The pixels are never decoded.
+ *
+ * @param path the jpg
+ * @param orientation the Orientation value, e.g. ORIENT_CW
+ * @return -1 if path is not a jpg, it has EXIF but no Orientation
+ *         tag to rewrite, or on error, 0 on success
+ */
+int exif_set_orientation(char* path, int orientation) {
+  FILE* fp;
+  unsigned char* exif;
+  long at, pos, len = 0, value;
+  int motorola, ret = -1;
+
+  if ((fp = fopen(path, "r+b")) == NULL)
+    return -1;
+
+  if ((pos = find_exif(fp, &at, &len)) < 0) {
+    fclose(fp);
+    return -1;
+  }
+  if (pos == 0) {
+    ret = insert_exif(path, fp, at, orientation);
+    fclose(fp);
+    return ret;
+  }
+
+  // rewrite the existing tag's value in place
+  if ((exif = (unsigned char*) malloc(len)) != NULL) {
+    if (fseek(fp, pos, SEEK_SET) == 0 && fread(exif, len, 1, fp) == 1
+	&& (value = find_orientation(exif, len, &motorola)) >= 0) {
+      unsigned char v[2];
+      v[0] = motorola ? 0 : orientation;
+      v[1] = motorola ? orientation : 0;
+      if (fseek(fp, pos + value, SEEK_SET) == 0 && fwrite(v, 2, 1, fp) == 1)
+	ret = 0;
+    }
+    free(exif);
+  }
+
+  if (fclose(fp) != 0)
+    ret = -1;
+  return ret;
+}
+
+/* Reads the Orientation tag of a jpg
+ *
+ * @param path the jpg
+ * @return the Orientation value, -1 if the jpg carries none or on error
+ */
+int exif_get_orientation(char* path) {
+  FILE* fp;
+  unsigned char* exif;
+  long at, pos, len = 0, value;
+  int motorola, ret = -1;
+
+  if ((fp = fopen(path, "rb")) == NULL)
+    return -1;
+  if ((pos = find_exif(fp, &at, &len)) > 0 && (exif = (unsigned char*) malloc(len)) != NULL) {
+    if (fseek(fp, pos, SEEK_SET) == 0 && fread(exif, len, 1, fp) == 1
+	&& (value = find_orientation(exif, len, &motorola)) >= 0 && value + 2 <= len)
+      ret = get16(exif + value, motorola);
+    free(exif);
+  }
+  fclose(fp);
+  return ret;
+}
+
+/* Reads the value of a SHORT or LONG IFD entry
+ *
+ * @param entry the 12-byte entry
+ * @param motorola the byte order
+ * @return the value, 0 for any other type
+ */
+static unsigned long entry_value(const unsigned char* entry, int motorola) {
+  unsigned type = get16(entry + 2, motorola);
+  if (type == TYPE_SHORT)
+    return get16(entry + 8, motorola);
+  if (type == TYPE_LONG)
+    return get32(entry + 8, motorola);
+  return 0;
+}
+
+/* Extracts the preview jpg cameras embed in IFD1 of the
+ * EXIF segment (typically 160x120) into its own file
+ *
+ * @param path the jpg to take the preview from
+ * @param dest the file to write the preview to
+ * @return -1 if path carries no preview or on error, 0 on success
+ */
+int exif_thumbnail(char* path, char* dest) {
+  FILE* fp, *out;
+  unsigned char* exif = NULL;
+  const unsigned char* tiff;
+  unsigned long ifd, offset = 0, length = 0;
+  unsigned i, count;
+  long at, pos, len = 0, tlen;
+  int motorola, ret = -1;
+
+  if ((fp = fopen(path, "rb")) == NULL)
+    return -1;
+  if ((pos = find_exif(fp, &at, &len)) <= 0 || len < 6 + 8 || (exif = (unsigned char*) malloc(len)) == NULL)
+    goto done;
+  if (fseek(fp, pos, SEEK_SET) != 0 || fread(exif, len, 1, fp) != 1)
+    goto done;
+
+  tiff = exif + 6;
+  tlen = len - 6;
+  if (memcmp(tiff, "MM", 2) == 0)
+    motorola = 1;
+  else if (memcmp(tiff, "II", 2) == 0)
+    motorola = 0;
+  else
+    goto done;
+
+  // skip over IFD0 to the offset of IFD1, stored right after IFD0's entries
+  ifd = get32(tiff + 4, motorola);
+  if (ifd + 2 > (unsigned long) tlen)
+    goto done;
+  count = get16(tiff + ifd, motorola);
+  if (ifd + 2 + count * 12 + 4 > (unsigned long) tlen)
+    goto done;
+  ifd = get32(tiff + ifd + 2 + count * 12, motorola);
+  if (ifd == 0 || ifd + 2 > (unsigned long) tlen)
+    goto done;
+
+  count = get16(tiff + ifd, motorola);
+  for (i = 0; i < count && ifd + 2 + (i + 1) * 12 <= (unsigned long) tlen; i++) {
+    const unsigned char* entry = tiff + ifd + 2 + i * 12;
+    if (get16(entry, motorola) == TAG_THUMB_OFFSET)
+      offset = entry_value(entry, motorola);
+    else if (get16(entry, motorola) == TAG_THUMB_LENGTH)
+      length = entry_value(entry, motorola);
+  }
+
+  // the offset is relative to the TIFF header; the preview is a jpg of its own
+  if (offset == 0 || length < 2 || offset + length > (unsigned long) tlen
+      || tiff[offset] != 0xff || tiff[offset + 1] != 0xd8)
+    goto done;
+  if ((out = fopen(dest, "wb")) == NULL)
+    goto done;
+  ret = fwrite(tiff + offset, length, 1, out) == 1 ? 0 : -1;
+  if (fclose(out) != 0)
+    ret = -1;
+  if (ret)
+    remove(dest);
+
+ done:
+  free(exif);
+  fclose(fp);
+  return ret;
+}
+
+/* Writes a 16 or 32-bit TIFF value in the byte order of the segment
+ *
+ * @param p the bytes
+ * @param v the value
+ * @param motorola 1 for big-endian ("MM"), 0 for little-endian ("II")
+ */
+static void put16(unsigned char* p, unsigned v, int motorola) {
+  p[motorola ? 0 : 1] = (v >> 8) & 0xff;
+  p[motorola ? 1 : 0] = v & 0xff;
+}
+
+static void put32(unsigned char* p, unsigned long v, int motorola) {
+  put16(p + (motorola ? 0 : 2), (v >> 16) & 0xffff, motorola);
+  put16(p + (motorola ? 2 : 0), v & 0xffff, motorola);
+}
+
+/* Builds the EXIF payload a resized copy of a photo is published with:
+ * IFD0 alone, with only the tags asked for. The rest, the Exif and GPS
+ * IFDs and the IFD1 preview among it, is dropped, so a thumbnail neither
+ * carries a preview bigger than itself nor gives away where it was taken.
+ * A payload with any tag at all has an Orientation, so it can be
+ * rewritten in place by exif_set_orientation().
+ *
+ * @param exif the source's payload, starting with "Exif\0\0", NULL for none
+ * @param len the payload length
+ * @param keep EXIF_ORIENTATION or EXIF_CAMERA
+ * @param orientation the Orientation to write, 0 for the source's
+ * @param out the payload to fill, EXIF_MAX bytes
+ * @return its length, 0 if there is nothing to keep
+ */
+long exif_trim(const unsigned char* exif, long len, int keep, int orientation, unsigned char* out) {
+  static const unsigned tags[] = {TAG_MAKE, TAG_MODEL, TAG_ORIENTATION, TAG_DATETIME, TAG_ARTIST, TAG_COPYRIGHT};
+  const unsigned char* values[sizeof(tags) / sizeof(tags[0])];
+  unsigned long sizes[sizeof(tags) / sizeof(tags[0])];
+  const unsigned char* tiff = NULL;
+  unsigned long ifd = 0, data;
+  unsigned i, t, count = 0, n = 0;
+  long tlen = len - 6;
+  int motorola = 1, kept = 0;
+
+  if (exif != NULL && tlen >= 8 && (memcmp(exif + 6, "MM", 2) == 0 || memcmp(exif + 6, "II", 2) == 0)) {
+    tiff = exif + 6;
+    motorola = tiff[0] == 'M';
+    ifd = get32(tiff + 4, motorola);
+    if (ifd + 2 <= (unsigned long) tlen)
+      count = get16(tiff + ifd, motorola);
+  }
+
+  // find each tag asked for in the source's IFD0: an Orientation, or an
+  // ASCII value short enough to be worth keeping
+  for (t = 0; t < sizeof(tags) / sizeof(tags[0]); t++) {
+    values[t] = NULL;
+    sizes[t] = 0;
+    if (keep != EXIF_CAMERA && tags[t] != TAG_ORIENTATION)
+      continue;
+    for (i = 0; i < count && ifd + 2 + (i + 1) * 12 <= (unsigned long) tlen; i++) {
+      const unsigned char* entry = tiff + ifd + 2 + i * 12;
+      unsigned long size = get32(entry + 4, motorola), at;
+      if (get16(entry, motorola) != tags[t])
+	continue;
+      if (tags[t] == TAG_ORIENTATION) {
+	if (get16(entry + 2, motorola) == TYPE_SHORT && orientation == 0)
+	  orientation = get16(entry + 8, motorola);
+      }
+      else if (get16(entry + 2, motorola) == TYPE_ASCII && size > 0 && size <= KEPT_MAX) {
+	at = size <= 4 ? (unsigned long) (entry + 8 - tiff) : get32(entry + 8, motorola);
+	if (at + size <= (unsigned long) tlen) {
+	  values[t] = tiff + at;
+	  sizes[t] = size;
+	  kept = 1;
+	}
+      }
+      break;
+    }
+  }
+  if (orientation == 0 && !kept)
+    return 0;
+
+  // "Exif\0\0", the TIFF header, then IFD0, with no IFD1 after it,
+  // then the values that don't fit in their entries, each at an even offset
+  memcpy(out, "Exif\0\0", 6);
+  memcpy(out + 6, motorola ? "MM" : "II", 2);
+  put16(out + 8, 42, motorola);
+  put32(out + 10, 8, motorola);
+  for (t = 0; t < sizeof(tags) / sizeof(tags[0]); t++)
+    n += tags[t] == TAG_ORIENTATION || values[t] != NULL;
+  put16(out + 6 + 8, n, motorola);
+  data = 8 + 2 + n * 12 + 4;
+  put32(out + 6 + data - 4, 0, motorola);
+  for (t = 0, i = 0; t < sizeof(tags) / sizeof(tags[0]); t++) {
+    unsigned char* entry = out + 6 + 8 + 2 + i * 12;
+    if (tags[t] != TAG_ORIENTATION && values[t] == NULL)
+      continue;
+    i++;
+    memset(entry, 0, 12);
+    put16(entry, tags[t], motorola);
+    if (tags[t] == TAG_ORIENTATION) {
+      put16(entry + 2, TYPE_SHORT, motorola);
+      put32(entry + 4, 1, motorola);
+      put16(entry + 8, orientation > 0 ? orientation : ORIENT_NORMAL, motorola);
+      continue;
+    }
+    put16(entry + 2, TYPE_ASCII, motorola);
+    put32(entry + 4, sizes[t], motorola);
+    if (sizes[t] <= 4) {
+      memcpy(entry + 8, values[t], sizes[t]);
+      continue;
+    }
+    put32(entry + 8, data, motorola);
+    memcpy(out + 6 + data, values[t], sizes[t]);
+    data += sizes[t];
+    if (data & 1)
+      out[6 + data++] = 0;
+  }
+  return 6 + data;
+}
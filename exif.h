@@ -0,0 +1,22 @@
+/* exif.h
+ * 15 October 2026
+ * header file for exif.c, reading and editing the EXIF APP1 segment of a jpg
+ */
+
+#ifndef __EXIF_H
+#define __EXIF_H
+
+#define ORIENT_NORMAL 1  // EXIF Orientation values: as stored
+#define ORIENT_CW     6  // display rotated 90 degrees clockwise
+#define ORIENT_CCW    8  // display rotated 90 degrees counter-clockwise
+
+#define EXIF_ORIENTATION 0  // what exif_trim() keeps: the Orientation alone
+#define EXIF_CAMERA      1  // or it with the camera, date and copyright tags
+#define EXIF_MAX 1024       // the longest payload exif_trim() writes
+
+int exif_get_orientation(char* path);
+int exif_set_orientation(char* path, int orientation);
+int exif_thumbnail(char* path, char* dest);
+long exif_trim(const unsigned char* exif, long len, int keep, int orientation, unsigned char* out);
+
+#endif // __EXIF_H
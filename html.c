@@ -0,0 +1,519 @@
+/* html.c
+ * 15 October 2026
+ * Writes "index.html" from a single process. Image processes finish in
+ * whatever order the user and the scheduler allow; each sends its entry,
+ * numbered with its index, down one shared pipe. The writer holds entries
+ * that arrive early in a reorder buffer and commits each one to the page
+ * the moment the entry before it has been committed, so no image process
+ * ever waits on, or wakes, another to keep the album in order.
+ *
+ * The album is built in memory and written with one write() and a
+ * rename() per page when it is done: a handful of syscalls per page,
+ * and the previous index.html stays whole until then.
+ *
+ * With a page size (-p), the album is split into complete html pages,
+ * index.html, index2.html, ... linked by prev/next.
+ *
+ * With sprites (-s), each page's thumbnails are packed into one sprite
+ * sheet, sprite.jpg, sprite2.jpg, ... and drawn as CSS background
+ * offsets into it: one request per page instead of one per photo.
+ *
+ * With precompression (-z), every file written also gets .gz and .br
+ * siblings, see precompress.c. Pages are then written as soon as they
+ * are full, so they compress while later images are still processed.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // PIPE_BUF under -std=c11
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "engine.h"
+#include "html.h"
+#include "lqip.h"
+#include "precompress.h"
+#include "sprite.h"
+
+/* Escapes text for html, for both a text node and a quoted attribute,
+ * so a caption can't break out of either. Stops at a whole character
+ * when out is full.
+ *
+ * @param text the text
+ * @param out the escaped text
+ * @param len the size of out
+ */
+static void escape(const char* text, char* out, size_t len) {
+  size_t n = 0;
+
+  for (; *text != '\0'; text++) {
+    const char* c;
+    char plain[2] = {*text, '\0'};
+    switch (*text) {
+    case '&': c = "&amp;"; break;
+    case '<': c = "&lt;"; break;
+    case '>': c = "&gt;"; break;
+    case '"': c = "&quot;"; break;
+    case '\'': c = "&#39;"; break;
+    default: c = plain;
+    }
+    if (n + strlen(c) >= len)
+      break;
+    strcpy(out + n, c);
+    n += strlen(c);
+  }
+  out[n] = '\0';
+}
+
+/* Formats an entry's html, however long it comes out
+ *
+ * @param format the printf() format
+ * @return the html, freed by the caller, NULL if out of memory
+ */
+static char* entry_html(const char* format, ...) {
+  va_list args;
+  char* html;
+  int len;
+
+  va_start(args, format);
+  len = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+  if (len < 0 || (html = (char*) malloc(len + 1)) == NULL)
+    return NULL;
+  va_start(args, format);
+  vsnprintf(html, len + 1, format, args);
+  va_end(args);
+  return html;
+}
+
+/* Sends an image's entry to the writer: the thumbnail,
+ * linked to the medium-sized image, and the caption. The thumbnail
+ * is loaded lazily and decoded off the main thread, and its size is
+ * given up front so the page doesn't shift as thumbnails come in.
+ * A placeholder (-l) is painted behind it until it does. A thumbnail
+ * in other formats (-T) is offered as a <picture>, whose sources the
+ * browser picks the first it can decode of, falling back on the <img>.
+ * With larger widths (-w), the photo is shown as wide as the screen, up
+ * to the widest, and the browser fetches the narrowest file that covers it.
+ * An entry longer than a fragment holds is sent in several, in order.
+ *
+ * @param fd the write end of the writer's pipe
+ * @param seq the image's index, from 1
+ * @param e the entry
+ * @return -1 on error, 0 on success
+ */
+int html_send(int fd, int seq, const entry_t* e) {
+  fragment_t f;
+  char* html;
+  char caption[sizeof(f.html)], size[48] = "", style[LQIP_LEN + 128] = "", a[LQIP_LEN + 160] = "";
+  char sources[SOURCES_MAX * (SRCSET_LEN + 128)] = "", srcset[SRCSET_LEN + 128] = "", sizes[64] = "";
+  int i, len, at;
+
+  memset(&f, 0, sizeof(f));
+  f.seq = seq;
+  escape(e->caption, caption, sizeof(caption));
+  // stretched over the thumbnail's box, which the browser blurs as it scales up
+  if (e->placeholder != NULL)
+    snprintf(style, sizeof(style), "background:url(%s) 0 0/100%% 100%%;", e->placeholder);
+  if (e->sprite && e->width > 0 && e->height > 0 && engine_format(e->thumb_name) != FMT_UNKNOWN &&
+      strlen(e->thumb_name) < sizeof(f.thumb)) {
+    // drawn from the sheet by its t<seq> class, see sheet(); the writer packs the pixels
+    strcpy(f.thumb, e->thumb_name);
+    f.turn = e->turn;
+    // the span's own background is the sheet, so the placeholder goes on the link around it
+    if (style[0] != '\0')
+      snprintf(a, sizeof(a), " style=\"display:inline-block;%s\"", style);
+    html = entry_html("<a href=\"%s\"%s><span class=\"sprite t%d\" role=\"img\" aria-label=\"%s\" "
+		      "style=\"width:%dpx;height:%dpx\"></span></a><h2>%s</h2>",
+		      e->med_name, a, seq, caption, e->width, e->height, caption);
+  } else {
+    if (e->width > 0 && e->height > 0)
+      snprintf(size, sizeof(size), " width=\"%d\" height=\"%d\"", e->width, e->height);
+    if (e->srcset != NULL) {
+      sprintf(sizes, " sizes=\"(max-width: %dpx) 100vw, %dpx\"", e->display_width, e->display_width);
+      snprintf(srcset, sizeof(srcset), " srcset=\"%s\"%s", e->srcset, sizes);
+      // width and height still set the aspect ratio while it loads
+      sprintf(style + strlen(style), "width:100%%;max-width:%dpx;height:auto;", e->display_width);
+    }
+    // with -e, rotated photos are only tagged, so have the browser honor the tag
+    if (e->exif_rotate)
+      strcat(style, "image-orientation: from-image");
+    if (style[0] != '\0')
+      snprintf(a, sizeof(a), " style=\"%s\"", style);
+    for (i = 0; i < SOURCES_MAX && e->sources[i] != NULL; i++) {
+      // the type is the first file's extension
+      char first[THUMB_LEN], *ext;
+      snprintf(first, sizeof(first), "%.*s", (int) strcspn(e->sources[i], " ,"), e->sources[i]);
+      ext = strrchr(first, '.');
+      snprintf(sources + strlen(sources), sizeof(sources) - strlen(sources),
+	       "<source srcset=\"%s\" type=\"image/%s\"%s>", e->sources[i], ext != NULL ? ext + 1 : "", sizes);
+    }
+    html = entry_html("<a href=\"%s\">%s%s<img src=\"%s\"%s%s loading=\"lazy\" decoding=\"async\"%s>%s</a><h2>%s</h2>",
+		      e->med_name, sources[0] ? "<picture>" : "", sources, e->thumb_name, srcset, size, a,
+		      sources[0] ? "</picture>" : "", caption);
+  }
+  if (html == NULL)
+    // still send it, empty, or every later image would wait on this one
+    fprintf(stderr, "Error: out of memory for the html of %s, leaving it out\n", e->thumb_name);
+
+  // as many fragments as it takes, each written whole
+  len = html != NULL ? (int) strlen(html) : 0;
+  at = 0;
+  do {
+    f.len = len - at < (int) sizeof(f.html) ? len - at : (int) sizeof(f.html);
+    f.more = at + f.len < len;
+    if (f.len > 0)
+      memcpy(f.html, html + at, f.len);
+    at += f.len;
+    if (write(fd, &f, sizeof(f)) != sizeof(f)) {
+      fprintf(stderr, "Error sending html for %s\n", e->thumb_name);
+      free(html);
+      return -1;
+    }
+    f.part++;
+  } while (f.more);
+  free(html);
+  return 0;
+}
+
+/* Reads one whole fragment from the pipe
+ *
+ * @return -1 at end of file or on error, 0 on success
+ */
+static int receive(int fd, fragment_t* f) {
+  size_t got = 0;
+  ssize_t n;
+  while (got < sizeof(*f)) {
+    if ((n = read(fd, (char*) f + got, sizeof(*f) - got)) <= 0)
+      return -1;
+    got += n;
+  }
+  return 0;
+}
+
+/* A committed entry */
+struct mark {
+  size_t end;      // where the entry ends in data
+  int seq;
+  int turn;
+  char* thumb;     // to pack into the page's sprite sheet, NULL if none
+};
+
+/* The album as it is built, in memory */
+struct buffer {
+  char* data;
+  size_t len;
+  size_t cap;
+  struct mark* marks;  // one per committed entry
+  int count;           // entries committed
+  int max;             // room in marks
+};
+
+/* Appends bytes to a buffer
+ *
+ * @return -1 if out of memory, 0 on success
+ */
+static int append(struct buffer* b, const char* data, size_t len) {
+  if (b->len + len > b->cap) {
+    size_t cap = b->cap ? b->cap : PIPE_BUF;
+    char* grown;
+    while (cap < b->len + len)
+      cap *= 2;
+    if ((grown = (char*) realloc(b->data, cap)) == NULL)
+      return -1;
+    b->data = grown;
+    b->cap = cap;
+  }
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+  return 0;
+}
+
+/* Commits one fragment to the album; the entry is marked
+ * once its last fragment is in
+ *
+ * @return -1 if out of memory, 0 on success
+ */
+static int commit(struct buffer* b, const fragment_t* f) {
+#if defined (VERBOSE) || (WAIT)
+  printf("html writer committing %d, part %d\n", f->seq, f->part);
+#endif
+  struct mark* m;
+  if (append(b, f->html, f->len))
+    return -1;
+  if (f->more)
+    return 0;
+  if (b->count == b->max) {
+    int max = b->max ? b->max * 2 : 64;
+    struct mark* marks = (struct mark*) realloc(b->marks, max * sizeof(struct mark));
+    if (marks == NULL)
+      return -1;
+    b->marks = marks;
+    b->max = max;
+  }
+  m = &b->marks[b->count++];
+  m->end = b->len;
+  m->seq = f->seq;
+  m->turn = f->turn;
+  m->thumb = f->thumb[0] != '\0' ? strdup(f->thumb) : NULL;
+  return 0;
+}
+
+/* Writes a file in one go: to a temporary file, then
+ * renamed over path, so path is never seen half written
+ *
+ * @param path the file to write
+ * @param data the contents
+ * @param len the length of data
+ * @param compressed 1 to also start writing its .gz and .br siblings
+ * @return -1 on error, 0 on success
+ */
+static int flush(char* path, const char* data, size_t len, int compressed) {
+  char tmp[PATH_MAX];
+  size_t done = 0;
+  ssize_t n;
+  int fd, ret = 0;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    return -1;
+  while (done < len && (n = write(fd, data + done, len - done)) > 0)
+    done += n;
+  if (done < len)
+    ret = -1;
+  if (close(fd) != 0)
+    ret = -1;
+  if (ret == 0 && rename(tmp, path) != 0)
+    ret = -1;
+  if (ret)
+    remove(tmp);
+  else if (compressed)
+    ret = precompress(path, data, len);
+  return ret;
+}
+
+/* The file name of a page: index.html, then index2.html, index3.html... */
+static void page_name(char* name, int page) {
+  if (page == 1)
+    strcpy(name, "index.html");
+  else
+    sprintf(name, "index%d.html", page);
+}
+
+/* Packs the thumbnails of entries first to last into a page's sprite
+ * sheet, and appends the page's style: where in the sheet each entry's
+ * t<seq> class is drawn from. A thumbnail left out of the sheet is drawn
+ * from its own file.
+ *
+ * @param b the album
+ * @param first the page's first entry
+ * @param last one past the page's last entry
+ * @param page the page, from 1, which names the sheet
+ * @param out the page being built
+ * @return -1 on error, 0 on success
+ */
+static int sheet(const struct buffer* b, int first, int last, int page, struct buffer* out) {
+  char** thumbs = (char**) malloc((last - first + 1) * sizeof(char*));
+  int* turns = (int*) malloc((last - first + 1) * sizeof(int));
+  int* seqs = (int*) malloc((last - first + 1) * sizeof(int));
+  cell_t* cells = (cell_t*) malloc((last - first + 1) * sizeof(cell_t));
+  char base[32], path[40], rule[PATH_MAX + 96];
+  int i, n = 0, ret = -1;
+
+  if (thumbs == NULL || turns == NULL || seqs == NULL || cells == NULL)
+    goto done;
+  for (i = first; i < last; i++) {
+    if (b->marks[i].thumb == NULL)
+      continue;
+    thumbs[n] = b->marks[i].thumb;
+    turns[n] = b->marks[i].turn;
+    seqs[n++] = b->marks[i].seq;
+  }
+  if (n == 0) {
+    ret = 0;
+    goto done;
+  }
+
+  if (page == 1)
+    strcpy(base, "sprite");
+  else
+    sprintf(base, "sprite%d", page);
+  if (sprite_sheet(thumbs, turns, n, base, path, cells) < 0)
+    goto done;
+
+  sprintf(rule, "<style>.sprite{display:inline-block;background:url(%s) no-repeat}\n", path);
+  if (append(out, rule, strlen(rule)))
+    goto done;
+  for (i = 0; i < n; i++) {
+    if (cells[i].x >= 0)
+      sprintf(rule, ".t%d{background-position:%dpx %dpx}\n", seqs[i], -cells[i].x, -cells[i].y);
+    else
+      snprintf(rule, sizeof(rule), ".t%d{background-image:url(%s);background-size:100%% 100%%}\n", seqs[i], thumbs[i]);
+    if (append(out, rule, strlen(rule)))
+      goto done;
+  }
+  ret = append(out, "</style>\n", strlen("</style>\n"));
+
+ done:
+  free(thumbs);
+  free(turns);
+  free(seqs);
+  free(cells);
+  return ret;
+}
+
+/* Writes one page of the album, a complete html
+ * document with prev/next links
+ *
+ * @param b the album
+ * @param page the page, from 1
+ * @param pages the number of pages
+ * @param l the layout
+ * @return -1 on error, 0 on success
+ */
+static int flush_page(const struct buffer* b, int page, int pages, const layout_t* l) {
+  struct buffer out = {NULL, 0, 0, NULL, 0, 0};
+  int first = (page - 1) * l->per_page, last = page * l->per_page < b->count ? page * l->per_page : b->count;
+  size_t from = first > 0 ? b->marks[first - 1].end : 0, to = last > 0 ? b->marks[last - 1].end : 0;
+  char head[256], nav[256] = "<nav>", name[32];
+  int ret = 0;
+
+  snprintf(head, sizeof(head), "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\">"
+	   "<title>Album, page %d of %d</title>\n", page, pages);
+  if (page > 1) {
+    page_name(name, page - 1);
+    sprintf(nav + strlen(nav), "<a href=\"%s\" rel=\"prev\">prev</a> ", name);
+  }
+  sprintf(nav + strlen(nav), "page %d of %d", page, pages);
+  if (page < pages) {
+    page_name(name, page + 1);
+    sprintf(nav + strlen(nav), " <a href=\"%s\" rel=\"next\">next</a>", name);
+  }
+  strcat(nav, "</nav>\n");
+
+  page_name(name, page);
+#ifdef VERBOSE
+  printf("html writer writing %s\n", name);
+#endif
+  if (append(&out, head, strlen(head)) || (l->sprites && sheet(b, first, last, page, &out)) ||
+      append(&out, "</head><body>\n", strlen("</head><body>\n")) || append(&out, nav, strlen(nav)) ||
+      (to > from && append(&out, b->data + from, to - from)) ||
+      append(&out, nav, strlen(nav)) || append(&out, "</body></html>\n", strlen("</body></html>\n")) ||
+      flush(name, out.data, out.len, l->precompress))
+    ret = -1;
+  free(out.data);
+  return ret;
+}
+
+/* The number of pages count entries fill */
+static int page_count(int count, int per_page) {
+  return count > 0 ? (count + per_page - 1) / per_page : 1;
+}
+
+/* Runs the writer: collects fragments in memory, in index order,
+ * until every image process has closed the pipe, then writes
+ * the album once. Fragments after a missing one (an image process
+ * that died) are kept in order at the end.
+ *
+ * With precompression, full pages are written as they fill instead,
+ * and the writer waits for their compressed copies before it returns.
+ *
+ * @param fd the read end of the writer's pipe
+ * @param l the layout of the album
+ * @return -1 on error, 0 on success
+ */
+int html_writer(int fd, const layout_t* l) {
+  fragment_t f;
+  fragment_t** pending = NULL;  // the reorder buffer: fragments that came in early
+  struct buffer album = {NULL, 0, 0, NULL, 0, 0};
+  struct buffer style = {NULL, 0, 0, NULL, 0, 0};
+  int npending = 0, cap = 0, next = 1, part = 0, i, ret = 0;
+  int pages = l->per_page > 0 ? page_count(l->images, l->per_page) : 0;  // if no image process dies
+  int written = 0;  // pages written so far
+
+  while (receive(fd, &f) == 0) {
+    if (f.seq != next || f.part != part) {
+      if (npending == cap) {
+	cap = cap ? cap * 2 : 8;
+	pending = (fragment_t**) realloc(pending, cap * sizeof(fragment_t*));
+      }
+      if (pending == NULL || (pending[npending] = (fragment_t*) malloc(sizeof(f))) == NULL) {
+	fprintf(stderr, "Error: out of memory for html\n");
+	return -1;
+      }
+      *pending[npending++] = f;
+      continue;
+    }
+
+    // commit this one, then whatever it was holding up
+    ret |= commit(&album, &f);
+    next += !f.more;
+    part = f.more ? part + 1 : 0;
+    for (i = 0; i < npending; i++) {
+      if (pending[i]->seq == next && pending[i]->part == part) {
+	ret |= commit(&album, pending[i]);
+	next += !pending[i]->more;
+	part = pending[i]->more ? part + 1 : 0;
+	free(pending[i]);
+	pending[i] = pending[--npending];
+	i = -1;  // rescan, the buffer is never longer than the images in flight
+      }
+    }
+
+    // the page filled up: start compressing it while the images go on
+    while (l->precompress && written < pages && (written + 1) * l->per_page <= album.count)
+      ret |= flush_page(&album, ++written, pages, l);
+  }
+
+  // gaps left by image processes that died: keep the rest in order
+  while (npending > 0) {
+    int low = 0;
+    for (i = 1; i < npending; i++)
+      if (pending[i]->seq < pending[low]->seq ||
+	  (pending[i]->seq == pending[low]->seq && pending[i]->part < pending[low]->part))
+	low = i;
+    // an entry cut short by its process dying still ends where it stops
+    for (i = 0; i < npending && pending[low]->more; i++)
+      if (pending[i]->seq == pending[low]->seq && pending[i]->part == pending[low]->part + 1)
+	break;
+    if (i == npending)
+      pending[low]->more = 0;
+    ret |= commit(&album, pending[low]);
+    free(pending[low]);
+    pending[low] = pending[--npending];
+  }
+  free(pending);
+
+#ifdef VERBOSE
+  printf("html writer has %d entries\n", album.count);
+#endif
+  if (l->per_page > 0) {
+    // an image process died, so the pages already written link to the wrong pages
+    if (page_count(album.count, l->per_page) != pages) {
+      pages = page_count(album.count, l->per_page);
+      written = 0;
+    }
+    while (written < pages)
+      ret |= flush_page(&album, ++written, pages, l);
+  }
+  else if (l->sprites) {
+    // the one sheet's style goes ahead of the entries
+    ret |= sheet(&album, 0, album.count, 1, &style);
+    ret |= append(&style, album.data, album.len);
+    ret |= flush("index.html", style.data, style.len, l->precompress);
+  }
+  else
+    ret |= flush("index.html", album.data, album.len, l->precompress);
+  if (ret)
+    fprintf(stderr, "Error writing the album's html\n");
+  if (l->precompress)
+    precompress_wait();
+  for (i = 0; i < album.count; i++)
+    free(album.marks[i].thumb);
+  free(album.data);
+  free(album.marks);
+  free(style.data);
+  return ret;
+}
@@ -0,0 +1,56 @@
+/* html.h
+ * 15 October 2026
+ * header file for html.c, writing "index.html" in image order from one process
+ */
+
+#ifndef __HTML_H
+#define __HTML_H
+
+#include <limits.h>
+
+#define THUMB_LEN 256  // longest thumbnail name a fragment carries for -s
+#define SOURCES_MAX 2  // formats a thumbnail is offered in besides its own (webp, avif)
+#define SRCSET_LEN 1024  // longest srcset an entry carries (-w)
+
+/* One image's entry in "index.html", or a piece of a long one, sent
+ * by its image process to the writer. Kept within PIPE_BUF so that every
+ * write() of one is atomic, however many image processes share the pipe.
+ */
+typedef struct fragment {
+  int seq;                                   // the image's index, from 1
+  int part;                                  // the piece of the entry, from 0
+  int more;                                  // 1 if the entry goes on in part + 1
+  int len;                                   // bytes used in html
+  int turn;                                  // see entry_t
+  char thumb[THUMB_LEN];                     // -s: packed into the page's sprite sheet, "" if not
+  char html[PIPE_BUF - 5 * sizeof(int) - THUMB_LEN];
+} fragment_t;
+
+/* What an image process knows about its entry */
+typedef struct entry {
+  char* thumb_name;
+  char* med_name;
+  char* caption;
+  int width;        // the thumbnail as displayed, 0 if unknown
+  int height;
+  int exif_rotate;  // 1 if the photo was only tagged with its rotation (-e)
+  int turn;         // the rotation only tagged on the thumbnail: 1 clockwise, 2 counter-clockwise, 0 none
+  int sprite;       // 1 to draw the thumbnail from the page's sprite sheet (-s)
+  char* placeholder; // a data URI painted until the thumbnail loads (-l), NULL for none
+  char* srcset;     // the thumbnail and the photo at larger widths (-w), "name 77w, ...", NULL for none
+  int display_width;  // with a srcset, the widest the photo displays, in CSS pixels
+  char* sources[SOURCES_MAX + 1];  // the srcset in other formats, best first, NULL-terminated (-T)
+} entry_t;
+
+/* How the writer lays the album out */
+typedef struct layout {
+  int images;       // the images in the album, from 1 to images
+  int per_page;     // entries per page (-p), 0 for the whole album in index.html
+  int sprites;      // 1 to draw thumbnails from a sprite sheet per page (-s)
+  int precompress;  // 1 to write .gz and .br copies of every page (-z)
+} layout_t;
+
+int html_send(int fd, int seq, const entry_t* e);
+int html_writer(int fd, const layout_t* l);
+
+#endif // __HTML_H
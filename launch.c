@@ -0,0 +1,142 @@
+/* launch.c
+ * 15 October 2026
+ * Starts magick programs. The magick binary is looked up on PATH once,
+ * before any image process is forked, instead of by every execlp().
+ * New processes come from posix_spawn(), which glibc runs as a
+ * clone(CLONE_VFORK): no copy of the caller's page tables, however
+ * much the caller has mapped.
+ *
+ * Every launch on behalf of an image can be counted, across all
+ * of its processes, through a pipe one byte per launch.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // fcntl() flags under -std=c11
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include "launch.h"
+
+#define RPIPE 0
+#define WPIPE 1
+
+extern char** environ;
+
+static char* magick_path = NULL;  // NULL until launch_init() finds it
+static int count_fd = -1;         // write end of the launch counter, -1 if not counting
+
+/* Looks magick up on PATH, once for the whole album
+ *
+ * @return -1 if it is not on PATH (launches then search PATH
+ *         themselves, and fail the same way), 0 on success
+ */
+int launch_init(void) {
+  char* path = getenv("PATH");
+  char* dirs, *dir, *save;
+
+  if (path == NULL || (dirs = strdup(path)) == NULL)
+    return -1;
+  for (dir = strtok_r(dirs, ":", &save); dir != NULL; dir = strtok_r(NULL, ":", &save)) {
+    char* candidate = (char*) malloc(strlen(dir) + strlen("/magick") + 1);
+    if (candidate == NULL)
+      break;
+    sprintf(candidate, "%s/magick", *dir ? dir : ".");
+    if (access(candidate, X_OK) == 0) {
+      magick_path = candidate;
+      break;
+    }
+    free(candidate);
+  }
+  free(dirs);
+  return magick_path != NULL ? 0 : -1;
+}
+
+/* Counts one launch toward the image being processed */
+static void count(void) {
+  char one = 1;
+  if (count_fd >= 0 && write(count_fd, &one, 1) != 1)
+    fprintf(stderr, "failed to count a launch\n");
+}
+
+/* Starts magick as a new process with posix_spawn()
+ *
+ * @param argv the arguments, argv[0] = "magick", NULL-terminated
+ * @param in the fd to become its stdin, -1 to inherit
+ * @param out the fd to become its stdout, -1 to inherit
+ * @return the pid of the new process, -1 if it could not be started
+ */
+int launch_magick(char* const argv[], int in, int out) {
+  posix_spawn_file_actions_t actions;
+  pid_t pid;
+  int err;
+
+  if (posix_spawn_file_actions_init(&actions) != 0)
+    return -1;
+  if (in >= 0)
+    posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+  if (out >= 0)
+    posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+
+  if (magick_path != NULL)
+    err = posix_spawn(&pid, magick_path, &actions, NULL, argv, environ);
+  else
+    err = posix_spawnp(&pid, "magick", &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+
+  if (err != 0)
+    return -1;
+  count();
+  return pid;
+}
+
+/* Replaces the calling process with magick, for a child that
+ * has already tried the engine and has nothing else left to do
+ *
+ * @param argv the arguments, argv[0] = "magick", NULL-terminated
+ * (returns only if the exec failed)
+ */
+void launch_exec(char* const argv[]) {
+  count();
+  if (magick_path != NULL)
+    execv(magick_path, argv);
+  else
+    execvp("magick", argv);
+}
+
+/* Starts counting the launches made from here on, by this process
+ * and by every process it forks after this call
+ *
+ * @param counter the pipe to create for the count
+ * @return -1 on error, 0 on success
+ */
+int launch_count_start(int counter[2]) {
+  if (pipe(counter) != 0)
+    return -1;
+  // magick itself never counts; only the album's own processes hold the write end
+  fcntl(counter[WPIPE], F_SETFD, FD_CLOEXEC);
+  fcntl(counter[RPIPE], F_SETFD, FD_CLOEXEC);
+  fcntl(counter[RPIPE], F_SETFL, O_NONBLOCK);
+  count_fd = counter[WPIPE];
+  return 0;
+}
+
+/* Stops counting and tallies the launches, once
+ * the processes that could launch have been waited for
+ *
+ * @param counter the pipe from launch_count_start()
+ * @return the number of launches
+ */
+int launch_count_end(int counter[2]) {
+  char buf[256];
+  int n, total = 0;
+
+  count_fd = -1;
+  close(counter[WPIPE]);
+  while ((n = read(counter[RPIPE], buf, sizeof(buf))) > 0)
+    total += n;
+  close(counter[RPIPE]);
+  return total;
+}
@@ -0,0 +1,16 @@
+/* launch.h
+ * 15 October 2026
+ * header file for launch.c, starting magick without fork() + PATH search
+ */
+
+#ifndef __LAUNCH_H
+#define __LAUNCH_H
+
+int launch_init(void);
+int launch_magick(char* const argv[], int in, int out);
+void launch_exec(char* const argv[]);
+
+int launch_count_start(int counter[2]);
+int launch_count_end(int counter[2]);
+
+#endif // __LAUNCH_H
@@ -0,0 +1,101 @@
+/* lqip.c
+ * 15 October 2026
+ * Low-quality image placeholders: each thumbnail shrunk to a few pixels,
+ * encoded as a tiny jpg and inlined in the html as a data URI. The page
+ * paints the placeholder, stretched (and so blurred) to the thumbnail's
+ * size, with the html itself, before any thumbnail has loaded.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "engine.h"
+#include "lqip.h"
+
+#define PREFIX "data:image/jpeg;base64,"
+
+/* Base64-encodes bytes
+ *
+ * @param in the bytes
+ * @param n the number of bytes
+ * @param out filled with the encoding, NUL-terminated,
+ *        at least 4 * ((n + 2) / 3) + 1 long
+ */
+static void base64(const unsigned char* in, unsigned long n, char* out) {
+  static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  unsigned long i;
+  for (i = 0; i + 2 < n; i += 3) {
+    *out++ = digits[in[i] >> 2];
+    *out++ = digits[(in[i] & 3) << 4 | in[i + 1] >> 4];
+    *out++ = digits[(in[i + 1] & 15) << 2 | in[i + 2] >> 6];
+    *out++ = digits[in[i + 2] & 63];
+  }
+  if (i < n) {
+    *out++ = digits[in[i] >> 2];
+    *out++ = digits[(in[i] & 3) << 4 | (i + 1 < n ? in[i + 1] >> 4 : 0)];
+    *out++ = i + 1 < n ? digits[(in[i + 1] & 15) << 2] : '=';
+    *out++ = '=';
+  }
+  *out = '\0';
+}
+
+/* Makes the placeholder of a thumbnail
+ *
+ * @param thumb the thumbnail, a jpg or png
+ * @param turn the rotation its pixels still need (1 clockwise,
+ *        2 counter-clockwise, 0 none), e.g. only tagged by -e
+ * @param uri filled with the placeholder as a data URI
+ * @param len the room in uri
+ * @return -1 if the engine can't decode thumb or the URI
+ *         doesn't fit, 0 on success
+ */
+int lqip_uri(const char* thumb, int turn, char* uri, int len) {
+  raster_t r, small = {0, 0, 0, NULL};
+  unsigned char* jpg = NULL;
+  unsigned long n;
+  int width, height, ret = -1;
+
+  if (engine_decode(thumb, &r) != 0)
+    return -1;
+  if (turn > 0 && engine_rotate_raster(&r, turn) != 0)
+    goto done;
+
+  // drop alpha onto white; a jpg has none
+  if (r.channels == 4) {
+    size_t i, pixels = (size_t) r.width * r.height;
+    for (i = 0; i < pixels; i++) {
+      unsigned char* p = r.pixels + i * 4;
+      int k;
+      for (k = 0; k < 3; k++)
+	r.pixels[i * 3 + k] = (p[k] * p[3] + 255 * (255 - p[3]) + 127) / 255;
+    }
+    r.channels = 3;
+  }
+
+  if (r.width >= r.height) {
+    width = LQIP_SIZE;
+    height = (r.height * LQIP_SIZE + r.width / 2) / r.width;
+  } else {
+    height = LQIP_SIZE;
+    width = (r.width * LQIP_SIZE + r.height / 2) / r.height;
+  }
+  if (width < 1)
+    width = 1;
+  if (height < 1)
+    height = 1;
+
+  if (engine_resample(&r, &small, width, height) != 0 ||
+      engine_encode_mem(&small, LQIP_QUALITY, &jpg, &n) != 0)
+    goto done;
+  if (strlen(PREFIX) + 4 * ((n + 2) / 3) + 1 > (unsigned long) len)
+    goto done;
+  strcpy(uri, PREFIX);
+  base64(jpg, n, uri + strlen(PREFIX));
+  ret = 0;
+
+ done:
+  free(jpg);
+  engine_free(&small);
+  engine_free(&r);
+  return ret;
+}
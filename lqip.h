@@ -0,0 +1,15 @@
+/* lqip.h
+ * 15 October 2026
+ * header file for lqip.c, tiny inline placeholders for the thumbnails
+ */
+
+#ifndef __LQIP_H
+#define __LQIP_H
+
+#define LQIP_SIZE 16      // the placeholder's longer side, in pixels
+#define LQIP_QUALITY 40   // it is blurred up to the thumbnail's size anyway
+#define LQIP_LEN 1024     // longest data URI kept, so a placeholder stays a small part of the page
+
+int lqip_uri(const char* thumb, int turn, char* uri, int len);
+
+#endif // __LQIP_H
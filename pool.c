@@ -0,0 +1,200 @@
+/* pool.c
+ * 15 October 2026
+ * A pool of long-lived ImageMagick workers, so that falling back on
+ * magick does not pay its process startup (delegate/config loading,
+ * OpenCL probing) on every resize and rotate. Each worker is one
+ * "magick -script -" reading jobs, one per line, from its stdin.
+ * https://imagemagick.org/script/magick-script.php
+ *
+ * Jobs write to a temporary file that is renamed over the output once
+ * the worker acknowledges, so a failed job never leaves a partial file
+ * and the caller can still fall back on a one-off magick.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // fcntl() flags under -std=c11
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "launch.h"
+#include "pool.h"
+
+#define RPIPE 0
+#define WPIPE 1
+#define ACK "ok"
+#define JOB_LEN 4096
+
+/* Keeps a descriptor out of the programs later children exec,
+ * so only the processes of this album ever hold the pool's pipes
+ */
+static void cloexec(int fd) {
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+/* Starts a pool of magick workers
+ *
+ * @param p the pool to fill, stopped with pool_stop()
+ * @param workers the number of workers, at most POOL_MAX
+ * @return -1 on error (p is left with no workers), 0 on success
+ */
+int pool_start(pool_t* p, int workers) {
+  char* argv[] = {"magick", "-script", "-", NULL};
+  int i, in[2], out[2];
+
+  memset(p, 0, sizeof(*p));
+  if (workers > POOL_MAX)
+    workers = POOL_MAX;
+  if (pipe(p->free) != 0)
+    return -1;
+  cloexec(p->free[RPIPE]);
+  cloexec(p->free[WPIPE]);
+
+  // a worker that died must show up as a failed write, not kill the submitter
+  signal(SIGPIPE, SIG_IGN);
+
+  for (i = 0; i < workers; i++) {
+    if (pipe(in) != 0)
+      break;
+    if (pipe(out) != 0) {
+      close(in[RPIPE]);
+      close(in[WPIPE]);
+      break;
+    }
+
+    // the album's ends stay out of the worker, and out of every later worker
+    cloexec(in[WPIPE]);
+    cloexec(out[RPIPE]);
+    p->pid[i] = launch_magick(argv, in[RPIPE], out[WPIPE]);
+    close(in[RPIPE]);
+    close(out[WPIPE]);
+    p->to[i] = in[WPIPE];
+    p->from[i] = out[RPIPE];
+    if (p->pid[i] < 0 || write(p->free[WPIPE], &i, sizeof(int)) != sizeof(int)) {
+      close(p->to[i]);
+      close(p->from[i]);
+      break;
+    }
+    p->workers++;
+  }
+
+  if (p->workers == 0) {
+    pool_stop(p);
+    return -1;
+  }
+  return 0;
+}
+
+/* Appends a token to a job line, single-quoted for the script
+ * tokenizer
+ *
+ * @return -1 if the token can't be quoted or the job is too long, 0 on success
+ */
+static int append(char* job, const char* token) {
+  if (strchr(token, '\'') != NULL || strchr(token, '\n') != NULL)
+    return -1;
+  if (strlen(job) + strlen(token) + 4 >= JOB_LEN)
+    return -1;
+  strcat(job, " '");
+  strcat(job, token);
+  strcat(job, "'");
+  return 0;
+}
+
+/* Reads one line of a worker's output, up to the newline
+ * (a byte at a time, so nothing of the next job is read ahead)
+ *
+ * @return -1 if the worker is gone, 0 on success
+ */
+static int read_line(int fd, char* line, int len) {
+  int n = 0;
+  char c;
+  while (read(fd, &c, 1) == 1) {
+    if (c == '\n') {
+      line[n] = '\0';
+      return 0;
+    }
+    if (n < len - 1)
+      line[n++] = c;
+  }
+  return -1;
+}
+
+/* Runs one job on an idle worker, blocking until one is free.
+ * The job reads its own input; the pool writes the result to out.
+ * e.g. ops = {"-read", img, "-resize", "25%", NULL}
+ *
+ * @param p the pool
+ * @param ops the magick options of the job, NULL-terminated
+ * @param out the file to write the result to
+ * @return -1 if there is no pool or the job failed (caller should
+ *         fall back on a one-off magick), 0 on success
+ */
+int pool_run(pool_t* p, char* const ops[], char* out) {
+  char job[JOB_LEN] = "";
+  char line[16];
+  char* tmp, *base;
+  int i, w, sent = 0, len, ret = -1;
+
+  if (p->workers == 0)
+    return -1;
+
+  // same directory and extension as out, so magick picks the same format
+  if ((tmp = (char*) malloc(strlen(out) + strlen(".pool_") + 1)) == NULL)
+    return -1;
+  base = strrchr(out, '/') != NULL ? strrchr(out, '/') + 1 : out;
+  sprintf(tmp, "%.*s.pool_%s", (int) (base - out), out, base);
+
+  for (i = 0; ops[i] != NULL; i++)
+    if (append(job, ops[i]))
+      goto done;
+  // write, clear the image list, then acknowledge through a 1x1 image's info
+  if (append(job, "-write") || append(job, tmp) || append(job, "-delete") || append(job, "0--1") ||
+      append(job, "-read") || append(job, "xc:") || append(job, "-format") || append(job, ACK "\\n") ||
+      append(job, "-write") || append(job, "info:-") || append(job, "-delete") || append(job, "0--1"))
+    goto done;
+  strcat(job, "\n");
+
+  if (read(p->free[RPIPE], &w, sizeof(int)) != sizeof(int))
+    goto done;
+  len = strlen(job);
+  while (sent < len) {
+    int n = write(p->to[w], job + sent, len - sent);
+    if (n <= 0)
+      break;
+    sent += n;
+  }
+  if (sent == len && read_line(p->from[w], line, sizeof(line)) == 0 && strcmp(line, ACK) == 0)
+    ret = rename(tmp, out) == 0 ? 0 : -1;
+
+  // a dead worker goes back too; its next job fails straight away
+  if (write(p->free[WPIPE], &w, sizeof(int)) != sizeof(int))
+    ret = -1;
+
+ done:
+  if (ret)
+    remove(tmp);
+  free(tmp);
+  return ret;
+}
+
+/* Stops the workers of a pool: closing their stdin ends
+ * their scripts, then they are waited for
+ *
+ * @param p the pool
+ */
+void pool_stop(pool_t* p) {
+  int i, status;
+  for (i = 0; i < p->workers; i++) {
+    close(p->to[i]);
+    close(p->from[i]);
+  }
+  for (i = 0; i < p->workers; i++)
+    waitpid(p->pid[i], &status, 0);
+  close(p->free[RPIPE]);
+  close(p->free[WPIPE]);
+  p->workers = 0;
+}
@@ -0,0 +1,27 @@
+/* pool.h
+ * 15 October 2026
+ * header file for pool.c, a pool of long-lived "magick -script" workers
+ */
+
+#ifndef __POOL_H
+#define __POOL_H
+
+#define POOL_MAX 8  // most workers a pool holds
+
+/* The workers of a pool. A worker is checked out by reading its
+ * index from the free pipe and checked back in by writing it back,
+ * so any process forked after pool_start() can submit jobs.
+ */
+typedef struct pool {
+  int workers;             // 0 when there is no pool
+  int pid[POOL_MAX];
+  int to[POOL_MAX];        // write end of each worker's stdin
+  int from[POOL_MAX];      // read end of each worker's stdout
+  int free[2];             // indices of the idle workers
+} pool_t;
+
+int pool_start(pool_t* p, int workers);
+int pool_run(pool_t* p, char* const ops[], char* out);
+void pool_stop(pool_t* p);
+
+#endif // __POOL_H
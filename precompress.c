@@ -0,0 +1,131 @@
+/* precompress.c
+ * 15 October 2026
+ * Precompressed copies of the album's files, path.gz (gzip) and
+ * path.br (brotli), both at their strongest settings, for a static
+ * server to send as they are instead of compressing per request.
+ *
+ * Each copy is compressed in a child of its own, so the two encoders,
+ * and the files of other pages, run alongside each other and alongside
+ * the images still being processed.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // PATH_MAX under -std=c11
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <zlib.h>
+#include <brotli/encode.h>
+#include "precompress.h"
+
+/* Writes a file through a temporary file renamed over it,
+ * so a server never sends a half-written copy
+ *
+ * @return -1 on error, 0 on success
+ */
+static int save(const char* path, const unsigned char* data, size_t len) {
+  char tmp[PATH_MAX];
+  size_t done = 0;
+  ssize_t n;
+  int fd, ret = 0;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    return -1;
+  while (done < len && (n = write(fd, data + done, len - done)) > 0)
+    done += n;
+  if (done < len)
+    ret = -1;
+  if (close(fd) != 0)
+    ret = -1;
+  if (ret == 0 && rename(tmp, path) != 0)
+    ret = -1;
+  if (ret)
+    remove(tmp);
+  return ret;
+}
+
+/* Gzips data into path, at level 9
+ *
+ * @return -1 on error, 0 on success
+ */
+static int gzip(const char* path, const char* data, size_t len) {
+  z_stream z;
+  unsigned char* out;
+  int ret = -1;
+
+  memset(&z, 0, sizeof(z));
+  // 15 + 16: the largest window, wrapped as gzip rather than zlib
+  if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+    return -1;
+  if ((out = (unsigned char*) malloc(deflateBound(&z, len))) != NULL) {
+    z.next_in = (unsigned char*) data;
+    z.avail_in = len;
+    z.next_out = out;
+    z.avail_out = deflateBound(&z, len);
+    if (deflate(&z, Z_FINISH) == Z_STREAM_END)
+      ret = save(path, out, z.total_out);
+    free(out);
+  }
+  deflateEnd(&z);
+  return ret;
+}
+
+/* Brotli-compresses data into path, at quality 11 and the largest window
+ *
+ * @return -1 on error, 0 on success
+ */
+static int brotli(const char* path, const char* data, size_t len) {
+  size_t n = BrotliEncoderMaxCompressedSize(len);
+  unsigned char* out;
+  int ret = -1;
+
+  if (n == 0 || (out = (unsigned char*) malloc(n)) == NULL)
+    return -1;
+  if (BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_MAX_WINDOW_BITS, BROTLI_MODE_TEXT,
+			    len, (const uint8_t*) data, &n, out))
+    ret = save(path, out, n);
+  free(out);
+  return ret;
+}
+
+/* Starts writing path.gz and path.br from path's contents, each in
+ * a child process; they are waited for with precompress_wait()
+ *
+ * @param path the file the contents were written to
+ * @param data the contents
+ * @param len the length of data
+ * @return -1 if a child couldn't be started, 0 on success
+ */
+int precompress(const char* path, const char* data, size_t len) {
+  int i, ret = 0;
+  pid_t pid;
+
+  for (i = 0; i < 2; i++) {
+    if ((pid = fork()) < 0) {
+      fprintf(stderr, "Error: failed to fork to compress %s\n", path);
+      ret = -1;
+    }
+    else if (pid == 0) {
+      char sibling[PATH_MAX];
+      snprintf(sibling, sizeof(sibling), "%s.%s", path, i == 0 ? "gz" : "br");
+      if ((i == 0 ? gzip(sibling, data, len) : brotli(sibling, data, len)) != 0) {
+	fprintf(stderr, "Error writing %s\n", sibling);
+	_exit(-1);
+      }
+      _exit(0);  // not exit(): the parent's stdio buffers are its to flush
+    }
+  }
+  return ret;
+}
+
+/* Waits for every copy started by precompress() to be written */
+void precompress_wait(void) {
+  int status;
+  while (wait(&status) > 0)
+    ;
+}
@@ -0,0 +1,14 @@
+/* precompress.h
+ * 15 October 2026
+ * header file for precompress.c, writing .gz and .br siblings of the album's files
+ */
+
+#ifndef __PRECOMPRESS_H
+#define __PRECOMPRESS_H
+
+#include <stddef.h>
+
+int precompress(const char* path, const char* data, size_t len);
+void precompress_wait(void);
+
+#endif // __PRECOMPRESS_H
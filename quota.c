@@ -0,0 +1,133 @@
+/* quota.c
+ * 15 October 2026
+ * Works out how many cpus and how much memory the album may use, to
+ * size how many images it converts at once. The cpus are those the
+ * album may be scheduled on (taskset, a cpuset), less any cgroup v2
+ * cpu quota; the memory is the machine's, less any cgroup v2 limit.
+ * Every cgroup from the album's own up to the root is checked, since
+ * the tightest limit on the way up is the one that holds.
+ * https://docs.kernel.org/admin-guide/cgroup-v2.html
+ */
+
+#define _GNU_SOURCE  // sched_getaffinity() and CPU_COUNT()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include "quota.h"
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define PATH_LEN 4096
+
+/* Finds the directory of the album's cgroup v2, from the
+ * "0::/path" line of /proc/self/cgroup
+ *
+ * @param dir filled with the directory, PATH_LEN long
+ * @return -1 if the album isn't under cgroup v2, 0 on success
+ */
+static int cgroup_dir(char* dir) {
+  char line[PATH_LEN];
+  FILE* fp;
+  int ret = -1;
+
+  if ((fp = fopen("/proc/self/cgroup", "r")) == NULL)
+    return -1;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if (strncmp(line, "0::", 3) != 0)
+      continue;
+    line[strcspn(line, "\n")] = '\0';
+    if (strlen(CGROUP_ROOT) + strlen(line + 3) < PATH_LEN) {
+      sprintf(dir, "%s%s", CGROUP_ROOT, strcmp(line + 3, "/") == 0 ? "" : line + 3);
+      ret = 0;
+    }
+    break;
+  }
+  fclose(fp);
+  return ret;
+}
+
+/* Steps from a cgroup's directory to its parent's
+ *
+ * @param dir the directory, cut short in place
+ * @return 0 once past the root, 1 otherwise
+ */
+static int cgroup_parent(char* dir) {
+  char* slash = strrchr(dir, '/');
+  if (slash == NULL || strlen(dir) <= strlen(CGROUP_ROOT))
+    return 0;
+  *slash = '\0';
+  return 1;
+}
+
+/* Reads the first line of one of a cgroup's files
+ *
+ * @param dir the cgroup's directory
+ * @param name the file, e.g. "cpu.max"
+ * @param line filled with the line
+ * @param len the size of line
+ * @return -1 if the cgroup has no such file, 0 on success
+ */
+static int cgroup_read(const char* dir, const char* name, char* line, int len) {
+  char path[PATH_LEN + 32];
+  FILE* fp;
+  int ret;
+
+  sprintf(path, "%s/%s", dir, name);
+  if ((fp = fopen(path, "r")) == NULL)
+    return -1;
+  ret = fgets(line, len, fp) != NULL ? 0 : -1;
+  fclose(fp);
+  return ret;
+}
+
+/* Counts the cpus the album may use: those it may run on,
+ * less any cgroup cpu quota, rounded up
+ *
+ * @return the number of cpus, at least 1
+ */
+int quota_cpus(void) {
+  cpu_set_t set;
+  char dir[PATH_LEN], line[64];
+  long cpus = 0, quota, period;
+
+  if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    cpus = CPU_COUNT(&set);
+  if (cpus <= 0 && (cpus = sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+    cpus = 1;
+
+  if (cgroup_dir(dir) == 0) {
+    do {
+      // "quota period" in microseconds, or "max period" for no quota
+      if (cgroup_read(dir, "cpu.max", line, sizeof(line)) == 0 &&
+	  sscanf(line, "%ld %ld", &quota, &period) == 2 && quota > 0 && period > 0 &&
+	  (quota + period - 1) / period < cpus)
+	cpus = (quota + period - 1) / period;
+    } while (cgroup_parent(dir));
+  }
+  return (int) cpus;
+}
+
+/* Finds how much memory the album may use: the machine's,
+ * less any cgroup memory limit
+ *
+ * @return the memory in bytes, -1 if unknown
+ */
+long quota_memory(void) {
+  char dir[PATH_LEN], line[64];
+  long pages = sysconf(_SC_PHYS_PAGES), page = sysconf(_SC_PAGESIZE), memory = -1, max;
+
+  if (pages > 0 && page > 0)
+    memory = pages * page;
+
+  if (cgroup_dir(dir) == 0) {
+    do {
+      // bytes, or "max" for no limit
+      if (cgroup_read(dir, "memory.max", line, sizeof(line)) == 0 &&
+	  sscanf(line, "%ld", &max) == 1 && max > 0 && (memory < 0 || max < memory))
+	memory = max;
+    } while (cgroup_parent(dir));
+  }
+  return memory;
+}
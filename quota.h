@@ -0,0 +1,12 @@
+/* quota.h
+ * 15 October 2026
+ * header file for quota.c, the cpus and memory this album may use
+ */
+
+#ifndef __QUOTA_H
+#define __QUOTA_H
+
+int quota_cpus(void);
+long quota_memory(void);
+
+#endif // __QUOTA_H
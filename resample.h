@@ -0,0 +1,58 @@
+/* resample.h
+ * 15 October 2026
+ * header file for resample.c, separable resampling with SIMD kernels
+ */
+
+#ifndef __RESAMPLE_H
+#define __RESAMPLE_H
+
+#include "engine.h"
+
+#define FILTER_BOX      0
+#define FILTER_TRIANGLE 1
+#define FILTER_LANCZOS3 2
+
+/* The precomputed taps for resampling one axis.
+ * Every output sample reads span source samples from start[i] on;
+ * the weights are stored taps (>= span, zero padded) per output sample,
+ * each repeated period times so they line up with interleaved pixels.
+ */
+typedef struct axis {
+  int span;       // source samples actually read per output sample
+  int taps;       // stride of the weights, span padded to a whole number of vectors
+  int period;     // floats per pixel: 1 for a single plane, 4 for padded rgb(a)
+  int* start;     // per output sample, the first source sample
+  float* w;       // dst_len * taps * period weights
+} axis_t;
+
+/* A resample fed one source row at a time, see resample_stream_start() */
+typedef struct stream {
+  axis_t ax;
+  axis_t ay;
+  int src_width;
+  int channels;
+  int period;            // floats per pixel, as in axis_t
+  float* row;            // the source row being pushed, as floats
+  float* ring;           // the last ay.span source rows, resampled horizontally
+  float* out;            // one vertically resampled row
+  const float** rows;    // the ring rows one output row reads, in order
+  int pushed;            // source rows pushed so far
+  int done;              // destination rows written so far
+  raster_t* dst;
+} stream_t;
+
+int resample_axis(axis_t* a, int src_len, int dst_len, int filter, int period);
+void resample_axis_free(axis_t* a);
+
+void resample_hrow(const axis_t* a, const float* in, int dst_len, float* out);
+void resample_vrow(const axis_t* a, const float* const* rows, int i, int n, float* out);
+
+int resample(const raster_t* src, raster_t* dst, int width, int height, int filter);
+int resample_stream_start(stream_t* s, int src_width, int src_height, int channels,
+			  raster_t* dst, int width, int height, int filter);
+void resample_stream_push(stream_t* s, const unsigned char* in);
+void resample_stream_free(stream_t* s);
+int resample_fixed(const raster_t* src, raster_t* dst, int width, int height);
+const char* resample_isa(void);
+
+#endif // __RESAMPLE_H
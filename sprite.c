@@ -0,0 +1,132 @@
+/* sprite.c
+ * 15 October 2026
+ * Packs a page's thumbnails into one sprite sheet, so the page loads
+ * one image instead of one per photo; the page then draws each
+ * thumbnail as a CSS background offset into the sheet.
+ *
+ * Thumbnails go on shelves in page order: left to right until the
+ * sheet is as wide as it is tall, then onto a new shelf below.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "engine.h"
+#include "sprite.h"
+
+/* Copies a thumbnail into the sheet at (x, y), converting
+ * gray to rgb and adding opaque alpha as the sheet needs
+ *
+ * @param sheet the sheet, 3 or 4 channels
+ * @param r the thumbnail, 1, 3 or 4 channels
+ */
+static void blit(raster_t* sheet, const raster_t* r, int x, int y) {
+  int i, j, k;
+  for (j = 0; j < r->height; j++) {
+    const unsigned char* in = r->pixels + (size_t) j * r->width * r->channels;
+    unsigned char* out = sheet->pixels + ((size_t) (y + j) * sheet->width + x) * sheet->channels;
+    for (i = 0; i < r->width; i++, in += r->channels, out += sheet->channels) {
+      for (k = 0; k < 3; k++)
+	out[k] = in[r->channels < 3 ? 0 : k];
+      if (sheet->channels == 4)
+	out[3] = r->channels == 4 ? in[3] : 255;
+    }
+  }
+}
+
+/* Packs thumbnails into one sprite sheet. Thumbnails the engine
+ * can't decode, or that don't fit, are left out (their cell's x is -1)
+ * for the page to load on their own.
+ *
+ * @param thumbs the thumbnails, in page order
+ * @param turns per thumbnail, the rotation its pixels still need
+ *        (1 clockwise, 2 counter-clockwise, 0 none), e.g. only tagged by -e
+ * @param n the number of thumbnails
+ * @param base the sheet's file name without extension, e.g. "sprite2"
+ * @param path filled with the sheet's file name: base.jpg, or base.png
+ *        if any thumbnail is a png, at least strlen(base) + 5 long
+ * @param cells filled with where each thumbnail is in the sheet
+ * @return the number of thumbnails packed (no sheet is written for 0), -1 on error
+ */
+int sprite_sheet(char* const thumbs[], const int turns[], int n, const char* base, char* path, cell_t cells[]) {
+  raster_t* r;
+  raster_t sheet = {0, 0, 0, NULL};
+  int i, x = 0, y = 0, shelf = 0, packed = 0, format = FMT_JPEG, ret = -1;
+  double area = 0;
+
+  if ((r = (raster_t*) calloc(n > 0 ? n : 1, sizeof(raster_t))) == NULL)
+    return -1;
+
+  for (i = 0; i < n; i++) {
+    cells[i].x = -1;
+    if (engine_decode(thumbs[i], &r[i]) != 0) {
+      r[i].pixels = NULL;
+      continue;
+    }
+    if (turns[i] > 0 && engine_rotate_raster(&r[i], turns[i]) != 0) {
+      engine_free(&r[i]);
+      continue;
+    }
+    if (engine_format(thumbs[i]) == FMT_PNG)
+      format = FMT_PNG;  // keeps transparency, and a png thumbnail isn't recompressed lossily
+    area += (double) r[i].width * r[i].height;
+    if (r[i].width > sheet.width)
+      sheet.width = r[i].width;
+  }
+
+  // about square, but never narrower than the widest thumbnail
+  if (sqrt(area) > sheet.width)
+    sheet.width = (int) ceil(sqrt(area));
+  if (sheet.width > SPRITE_MAX)
+    sheet.width = SPRITE_MAX;
+
+  for (i = 0; i < n; i++) {
+    if (r[i].pixels == NULL || r[i].width > sheet.width)
+      continue;
+    if (x + r[i].width > sheet.width) {
+      x = 0;
+      y += shelf;
+      shelf = 0;
+    }
+    if (y + r[i].height > SPRITE_MAX)
+      break;
+    cells[i].x = x;
+    cells[i].y = y;
+    cells[i].width = r[i].width;
+    cells[i].height = r[i].height;
+    x += r[i].width;
+    if (r[i].height > shelf)
+      shelf = r[i].height;
+    packed++;
+  }
+  sheet.height = y + shelf;
+
+  sprintf(path, "%s.%s", base, format == FMT_PNG ? "png" : "jpg");
+  if (packed == 0) {
+    ret = 0;
+    goto done;
+  }
+
+  // a jpg's unused corners are white, a png's transparent
+  sheet.channels = format == FMT_PNG ? 4 : 3;
+  if ((sheet.pixels = (unsigned char*) malloc((size_t) sheet.width * sheet.height * sheet.channels)) == NULL)
+    goto done;
+  memset(sheet.pixels, format == FMT_PNG ? 0 : 255, (size_t) sheet.width * sheet.height * sheet.channels);
+  for (i = 0; i < n; i++)
+    if (cells[i].x >= 0)
+      blit(&sheet, &r[i], cells[i].x, cells[i].y);
+
+  if (engine_encode(&sheet, path, format) != 0) {
+    fprintf(stderr, "Error writing sprite sheet %s\n", path);
+    goto done;
+  }
+  ret = packed;
+
+ done:
+  for (i = 0; i < n; i++)
+    engine_free(&r[i]);
+  free(r);
+  engine_free(&sheet);
+  return ret;
+}
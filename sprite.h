@@ -0,0 +1,21 @@
+/* sprite.h
+ * 15 October 2026
+ * header file for sprite.c, packing thumbnails into one sprite sheet
+ */
+
+#ifndef __SPRITE_H
+#define __SPRITE_H
+
+#define SPRITE_MAX 65500  // the widest and tallest a jpg can be
+
+/* Where one thumbnail landed in a sprite sheet */
+typedef struct cell {
+  int x;        // -1 if the thumbnail couldn't be packed
+  int y;
+  int width;
+  int height;
+} cell_t;
+
+int sprite_sheet(char* const thumbs[], const int turns[], int n, const char* base, char* path, cell_t cells[]);
+
+#endif // __SPRITE_H